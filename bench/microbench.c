@@ -0,0 +1,408 @@
+/*
+ * Sorbonne Université - PPAR (S1-24)
+ * Project - Direct Meet-in-the-Middle Attack
+ *
+ * Microbenchmarks of the components of the search: the Speck cipher, the f,
+ * g and is_good_pair kernels, murmur64, the insertions and probes of the
+ * dictionary engines at several loads, the routing of the elements from their
+ * sender to the dictionary of their owner, and the exchange of buffers of
+ * several sizes.
+ * Each benchmark prints a CSV row (or a line of JSON with --format json) with
+ * the operations per second of a single thread:
+ *
+ *     mpiexec -n 4 ./build/microbench --n 32 --slots 24 --format json
+ *
+ * All processes take part in the exchanges; the other benchmarks only run on
+ * the root. The program includes mitm_parallel.c, whose main is renamed, so
+ * that it measures the very functions of the search on their globals.
+ *
+ * Authors: Matheus FERNANDES MORENO
+ *          Daniel MACHADO CARNEIRO FALLER
+ */
+
+#define main mitm_main
+#include "../src/mitm_parallel.c"
+#undef main
+
+#ifndef BENCH_MIN_TIME
+#define BENCH_MIN_TIME          0.2         /* seconds per benchmark */
+#endif
+#define BENCH_BATCH             (1 << 14)   /* operations between clock reads */
+#define BENCH_MIN_FILL          64          /* elements per buffer exchanged */
+#define BENCH_MAX_FILL          (1 << 16)
+
+bool json_output = false;
+int table_bits = 22;            /* the tables have 2**table_bits slots */
+u64 bench_sink;                 /* keeps the results of the computations */
+
+/* Print the result of the benchmark `name` of `variant` (a kernel, engine or
+   exchange), with a parameter (load of the table, elements per buffer). */
+void report(const char *name, const char *variant, double param, u64 ops,
+            double seconds)
+{
+    if (json_output)
+        printf("{\"benchmark\": \"%s\", \"variant\": \"%s\", \"param\": %g, "
+               "\"n\": %d, \"processes\": %d, \"ops\": %" PRIu64 ", "
+               "\"seconds\": %.6f, \"ops_per_s\": %.0f}\n", name, variant,
+               param, (int) n, num_processes, ops, seconds, ops / seconds);
+    else
+        printf("%s,%s,%g,%d,%d,%" PRIu64 ",%.6f,%.0f\n", name, variant, param,
+               (int) n, num_processes, ops, seconds, ops / seconds);
+    fflush(stdout);
+}
+
+/* Returns true until BENCH_MIN_TIME seconds have passed since `start`, and
+   the time elapsed in `elapsed`. */
+bool bench_running(double start, double *elapsed)
+{
+    *elapsed = wtime() - start;
+    return *elapsed < BENCH_MIN_TIME;
+}
+
+/* Encryptions of a block with a fixed key schedule. */
+void bench_speck()
+{
+    u32 K[4] = {1, 2, 3, 4}, rk[27], block[2] = {0, 0};
+    u64 ops = 0;
+    double start = wtime(), elapsed;
+
+    Speck64128KeySchedule(K, rk);
+    do {
+        for (int i = 0; i < BENCH_BATCH; i++)
+            Speck64128Encrypt(block, block, rk);
+        ops += BENCH_BATCH;
+    } while (bench_running(start, &elapsed));
+    bench_sink ^= block[0];
+    report("speck_encrypt", "scalar", 0, ops, elapsed);
+}
+
+/* Evaluations of f and g (key schedule and encryption or decryption), also
+   with the check bits when n > 32 (the parameter is their number), and checks
+   of pairs (two encryptions), by the kernels supported by the CPU. */
+void bench_kernels()
+{
+    int num_kernels = sizeof(kernels) / sizeof(*kernels);
+    u64 keys[KEY_BATCH_SIZE], images[KEY_BATCH_SIZE];
+
+    for (int i = 0; i < num_kernels; i++) {
+        if (!kernels[i].supported())
+            continue;
+        for (int checked = 0; checked <= (n > 32); checked++) {
+            if (checked)
+                setup_check_bits();
+            for (int use_g = 0; use_g < 2; use_g++) {
+                void (*eval)(const u64 k[], u64 out[], int count) =
+                    use_g ? kernels[i].g_batch : kernels[i].f_batch;
+                u64 ops = 0;
+                double start = wtime(), elapsed;
+                do {
+                    for (int b = 0; b < BENCH_BATCH; b += KEY_BATCH_SIZE) {
+                        for (int k = 0; k < KEY_BATCH_SIZE; k++)
+                            keys[k] = (ops + b + k) & mask;
+                        eval(keys, images, KEY_BATCH_SIZE);
+                        bench_sink ^= images[0];
+                    }
+                    ops += BENCH_BATCH;
+                } while (bench_running(start, &elapsed));
+                report(use_g ? "g" : "f", kernels[i].name, check_bits, ops,
+                       elapsed);
+            }
+        }
+        check_bits = 0;
+        image_mask = mask;
+
+        bool good[KEY_BATCH_SIZE];
+        u64 ops = 0;
+        double start = wtime(), elapsed;
+        do {
+            for (int b = 0; b < BENCH_BATCH; b += KEY_BATCH_SIZE) {
+                for (int k = 0; k < KEY_BATCH_SIZE; k++) {
+                    keys[k] = (ops + b + k) & mask;
+                    images[k] = ~keys[k] & mask;
+                }
+                kernels[i].is_good_pair_batch(keys, images, good,
+                                              KEY_BATCH_SIZE);
+                bench_sink ^= good[0];
+            }
+            ops += BENCH_BATCH;
+        } while (bench_running(start, &elapsed));
+        report("is_good_pair", kernels[i].name, 0, ops, elapsed);
+    }
+}
+
+/* Hashes of consecutive keys. */
+void bench_murmur()
+{
+    u64 ops = 0, sum = 0;
+    double start = wtime(), elapsed;
+
+    do {
+        for (int i = 0; i < BENCH_BATCH; i++)
+            sum += murmur64(ops + i);
+        ops += BENCH_BATCH;
+    } while (bench_running(start, &elapsed));
+    bench_sink ^= sum;
+    report("murmur64", "scalar", 0, ops, elapsed);
+}
+
+/* Insertions and probes of each engine, around the loads of `loads`: the
+   table is filled up to each load, timing the last slots / 64 insertions,
+   then probed with keys that are absent, like most probes of a search. */
+void bench_dict()
+{
+    const double loads[] = {0.25, 0.5, 0.75, 1 / SLOTS_PER_ENTRY};
+    int num_loads = sizeof(loads) / sizeof(*loads);
+    int num_engines = sizeof(dict_engines) / sizeof(*dict_engines);
+    u64 slots = 1ull << table_bits, timed = slots / 64;
+    u64 values[N_PROBES_MAX];
+
+    dict_size_global = slots;
+    shard_start = 0;
+    for (int e = 0; e < num_engines; e++) {
+        dict = &dict_engines[e];
+        dict_setup(slots);
+        u64 inserted = 0;
+        for (int l = 0; l < num_loads; l++) {
+            u64 target = loads[l] * slots;
+            for (; inserted < target - timed; inserted++)
+                dict_insert(inserted, inserted & mask);
+            double start = wtime();
+            for (; inserted < target; inserted++)
+                dict_insert(inserted, inserted & mask);
+            report("dict_insert", dict->name, loads[l], timed,
+                   wtime() - start);
+
+            u64 ops = 0, found = 0;
+            double elapsed;
+            start = wtime();
+            do {
+                for (int i = 0; i < BENCH_BATCH; i++)
+                    found += dict_probe(slots + ops + i, N_PROBES_MAX, values);
+                ops += BENCH_BATCH;
+            } while (bench_running(start, &elapsed));
+            bench_sink ^= found;
+            report("dict_probe", dict->name, loads[l], ops, elapsed);
+        }
+    }
+}
+
+/* Copy the elements of the images start, ..., start + count - 1 (with
+   themselves as values) to `elements`, as the senders would send them. */
+void route_elements(u64 start, u64 count, u64 *elements)
+{
+    for (u64 i = 0; i < count; i += thread_buffer_size) {
+        u64 slice = MIN(thread_buffer_size, count - i);
+        threads_counts[0] = 0;
+        for (u64 j = 0; j < slice; j++)
+            add_to_buffer(0, start + i + j, (start + i + j) & mask);
+        memcpy(elements + element_words * i, buffers->send,
+               sizeof(u64) * element_words * slice);
+    }
+}
+
+/* Per-element costs of the path of an image: the sender hashes it to find
+   its owner and appends it to its buffer (add_to_buffer), and the owner
+   inserts or probes the element received (insert_elements, probe_elements,
+   with keys that are absent). The table of 2**table_bits slots is a single
+   shard, half full; a quarter of the slots are then inserted and probed.
+   It only runs on the root, so the send buffer of the shard is a local one
+   instead of the buffers of setup_buffers (shared windows with --exchange
+   hier, allocated by all processes). */
+void bench_route()
+{
+    int processes = num_processes;
+    u64 slots = 1ull << table_bits, count = slots / 4;
+    u64 *elements = malloc(sizeof(u64) * element_words * count);
+    if (elements == NULL)
+        err(1, "impossible to allocate the elements");
+
+    num_processes = 1;
+    dict = &dict_engines[0];
+    dict_size = dict_size_global = slots;
+    shard_start = 0;
+    dict_setup(slots);
+
+    /* the slice of a single thread, sized as by setup_buffers */
+    struct buffer_set route_set = { .send = NULL };
+    u64 route_count = 0;
+    thread_buffer_size = buffer_size = MAX(GET_BUFFER_SIZE(slots), 1);
+    route_set.send = malloc(sizeof(u64) * element_words * buffer_size);
+    if (route_set.send == NULL)
+        err(1, "impossible to allocate the buffers");
+    buffers = &route_set;
+    threads_counts = &route_count;
+
+    u64 ops = 0;
+    double start = wtime(), elapsed;
+    do {
+        threads_counts[0] = 0;
+        for (u64 i = 0; i < thread_buffer_size; i++)
+            add_to_buffer(0, ops + i, (ops + i) & mask);
+        ops += thread_buffer_size;
+    } while (bench_running(start, &elapsed));
+    bench_sink ^= buffers->send[0];
+    report("add_to_buffer", "flat", 0, ops, elapsed);
+
+    for (u64 i = 0; i < slots / 2; i++)
+        dict_insert(i, i & mask);
+    route_elements(slots, count, elements);
+    start = wtime();
+    insert_elements(elements, count);
+    report("insert_elements", dict->name, 0.5, count, wtime() - start);
+
+    struct candidates cand = { .count = 0 };
+    u64 k1[MAX_SOLUTIONS], k2[MAX_SOLUTIONS];
+    int nres = 0;
+    route_elements(2 * slots, count, elements);
+    start = wtime();
+    probe_elements(elements, count, &cand, &nres, MAX_SOLUTIONS, k1, k2);
+    flush_candidates(&cand, &nres, MAX_SOLUTIONS, k1, k2);
+    report("probe_elements", dict->name, 0.75, count, wtime() - start);
+
+    free(route_set.send);
+    free(elements);
+    buffers = NULL;
+    threads_counts = NULL;
+    num_processes = processes;
+}
+
+/* Exchanges of the buffers (all-to-all of the counts, then of the elements)
+   holding from BENCH_MIN_FILL to BENCH_MAX_FILL elements for each process.
+   The rate is in elements sent per second by a process. */
+void bench_exchange()
+{
+    const char *exchange_names[] = {"flat", "hier"};
+
+    /* buffers of BENCH_MAX_FILL elements per process */
+    dict_size_global = ceil(BENCH_MAX_FILL / BUFFER_RELATIVE_SIZE)
+                       * num_processes;
+    setup_buffers();
+
+    for (u64 fill = BENCH_MIN_FILL; fill <= thread_buffer_size; fill *= 4) {
+        buffer_fill = fill;
+
+        /* all processes run the same number of exchanges, doubled until
+           they last BENCH_MIN_TIME on the slowest one */
+        double time = 0;
+        int exchanges = 1;
+        for (;; exchanges *= 2) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            double start = wtime();
+            for (int i = 0; i < exchanges; i++) {
+                struct buffer_set *set = buffers;
+                for (int p = 0; p < num_processes; p++)
+                    set->send_counts[p] = fill;
+                exchange_buffers(0);
+                wait_exchange(set);
+            }
+            double elapsed = wtime() - start;
+            MPI_Allreduce(&elapsed, &time, 1, MPI_DOUBLE, MPI_MAX,
+                          MPI_COMM_WORLD);
+            if (time >= BENCH_MIN_TIME)
+                break;
+        }
+        if (rank == ROOT_RANK)
+            report("exchange_buffers", exchange_names[exchange_mode], fill,
+                   fill * num_processes * exchanges, time);
+    }
+}
+
+/************************** command-line options ****************************/
+
+void bench_usage(char **argv)
+{
+        printf("%s [OPTIONS]\n\n", argv[0]);
+        printf("Options:\n");
+        printf("--n N                       block size [default 32]\n");
+        printf("--slots B                   tables of 2^B slots [default 22]\n");
+        printf("--exchange NAME             flat or hier(archical) all-to-all\n");
+        printf("--ranks-per-node K          split the nodes in groups of K processes\n");
+        printf("--format NAME               csv or json (lines) [default csv]\n");
+        exit(0);
+}
+
+void bench_command_line_options(int argc, char **argv)
+{
+        struct option longopts[7] = {
+                {"n", required_argument, NULL, 'n'},
+                {"slots", required_argument, NULL, 's'},
+                {"exchange", required_argument, NULL, 'x'},
+                {"ranks-per-node", required_argument, NULL, 'R'},
+                {"format", required_argument, NULL, 'f'},
+                {"help", no_argument, NULL, 'h'},
+                {NULL, 0, NULL, 0}
+        };
+        char ch;
+        n = 32;
+        while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+                switch (ch) {
+                case 'n':
+                        n = atoi(optarg);
+                        break;
+                case 's':
+                        table_bits = atoi(optarg);
+                        if (table_bits < 10 || table_bits > 40)
+                                errx(1, "--slots must be between 10 and 40");
+                        break;
+                case 'x':
+                        if (strcmp(optarg, "flat") == 0)
+                                exchange_mode = FLAT_EXCHANGE;
+                        else if (strcmp(optarg, "hier") == 0)
+                                exchange_mode = HIER_EXCHANGE;
+                        else
+                                errx(1, "unknown exchange \"%s\" (flat or hier)", optarg);
+                        break;
+                case 'R':
+                        ranks_per_node = atoi(optarg);
+                        if (ranks_per_node < 1)
+                                errx(1, "--ranks-per-node must be positive");
+                        break;
+                case 'f':
+                        if (strcmp(optarg, "json") == 0)
+                                json_output = true;
+                        else if (strcmp(optarg, "csv") != 0)
+                                errx(1, "unknown format \"%s\" (csv or json)", optarg);
+                        break;
+                case 'h':
+                        bench_usage(argv);
+                        break;
+                default:
+                        errx(1, "Unknown option\n");
+                }
+        }
+        if (n < 16 || n > 48)
+                errx(1, "--n must be between 16 and 48");
+        mask = image_mask = (1ull << n) - 1;
+        if (PACKED_ELEMENTS && 2 * n <= 64)
+                element_words = 1;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int thread_support;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    bench_command_line_options(argc, argv);
+    setup_topology();
+    select_kernel(NULL);
+    setup_telemetry();
+
+    if (rank == ROOT_RANK) {
+        if (!json_output)
+            printf("benchmark,variant,param,n,processes,ops,seconds,"
+                   "ops_per_s\n");
+        bench_speck();
+        bench_kernels();
+        bench_murmur();
+        bench_dict();
+        bench_route();
+    }
+    bench_exchange();
+
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/bin/bash
+#
+# Sorbonne Université - PPAR (S1-24)
+# Project - Direct Meet-in-the-Middle Attack
+#
+# Strong and weak scaling of the search on a single machine, with mpiexec on
+# localhost. The processes double from 1 up to MAX_PROCESSES; the strong
+# scaling keeps the block size N, the weak scaling adds one bit per doubling
+# (the same keys per process and per round). Every run appends its keys per
+# second in each phase to the report (CSV or JSON lines, after FORMAT) and its
+# output to a log, and the table of the speedups is printed at the end.
+#
+#     bench/scaling.sh strong|weak [extra options of mitm_parallel]
+#
+# Environment: N (block size, default 22), MAX_PROCESSES (default: the number
+# of cores), THREADS, MEM (in GB), FORMAT (csv or json), LOGS_DIR, and MPIEXEC
+# (e.g. "mpiexec --oversubscribe" to go beyond the cores).
+#
+# Authors: Matheus FERNANDES MORENO
+#          Daniel MACHADO CARNEIRO FALLER
+
+set -e
+
+MODE=${1:-strong}
+shift || true
+N=${N:-22}
+MAX_PROCESSES=${MAX_PROCESSES:-$(nproc)}
+THREADS=${THREADS:-1}
+FORMAT=${FORMAT:-csv}
+LOGS_DIR=${LOGS_DIR:-logs}
+MPIEXEC=${MPIEXEC:-mpiexec}
+BINARY=${BINARY:-./build/mitm_parallel}
+
+# any challenge will do: without EARLY_EXIT, the search sweeps all the keys
+C0=${C0:-0ce1f5e3b2d4e8c8}
+C1=${C1:-4f7b73b48e470ee6}
+
+if [ "$MODE" != strong ] && [ "$MODE" != weak ]; then
+    echo "usage: $0 strong|weak [options]" >&2
+    exit 1
+fi
+
+mkdir -p "$LOGS_DIR"
+STAMP=$(date +%F-%T)
+REPORT=$LOGS_DIR/scaling-$MODE-$STAMP.$FORMAT
+LOG=$LOGS_DIR/scaling-$MODE-$STAMP.log
+MEM_OPTION=${MEM:+--mem $MEM}
+
+echo "processes n seconds speedup efficiency"
+p=1
+n=$N
+while [ "$p" -le "$MAX_PROCESSES" ]; do
+    $MPIEXEC -n "$p" "$BINARY" --n "$n" --C0 "$C0" --C1 "$C1" \
+        --threads "$THREADS" $MEM_OPTION --report "$REPORT" "$@" >> "$LOG"
+
+    # the search time is the sum of the processing and communication times
+    seconds=$(tail -n 40 "$LOG" | awk '/^Processing time:/ { t = $3 }
+        /^Communication time:/ { c = $3 } END { print t + c }')
+    if [ "$p" -eq 1 ]; then
+        base=$seconds
+    fi
+    awk -v p="$p" -v n="$n" -v t="$seconds" -v b="$base" -v mode="$MODE" \
+        'BEGIN { s = (mode == "strong") ? b / t : b / t * p;
+                 printf "%d %d %.2f %.2f %.0f%%\n", p, n, t, s, 100 * s / p }'
+
+    p=$((p * 2))
+    if [ "$MODE" = weak ]; then
+        n=$((n + 1))
+    fi
+done
+echo "Report: $REPORT"
+echo "Log: $LOG"
@@ -17,8 +17,11 @@
 #OAR -O mitm_collisions_%jobid%.out
 #OAR -E mitm_collisions_%jobid%.err
 
-NUM_CORES=256
+NUM_NODES=26
+NUM_THREADS=52                          # one process per node, a thread per core
 MEM_AVAILABLE=9984
+CHECKPOINT_DIR=$HOME/mitm_checkpoints   # to resume after a failure
+CHECKPOINT_INTERVAL=1800
 ARGUMENTS=(
     "--n 25 --C0 0f540bf824f87e3f --C1 6cc642b7e61ee75e"
     "--n 26 --C0 45969a884ea5be9b --C1 d2832ca643ecaf99"
@@ -56,14 +59,20 @@ export OMPI_MCA_btl='^openib'
 mpiexec --map-by ppr:1:node --hostfile $OAR_NODEFILE hostname
 
 # Compile the program
-mpicc -g mitm_parallel.c -O3 -Wall -Wextra -lm -D EARLY_EXIT=1 -o mitm_parallel
+mpicc -g mitm_parallel.c -O3 -Wall -Wextra -fopenmp -lm -D EARLY_EXIT=1 -o mitm_parallel
 chmod u+x mitm_parallel
 
 # Search for collisions!
 for arg_list in "${ARGUMENTS[@]}"
 do
     echo "/// new collision search start ///"
-    # ppr:10:node since we have 26 nodes and need 256 cores
-    mpiexec -n $NUM_CORES --map-by ppr:10:node --hostfile $OAR_NODEFILE ./mitm_parallel \
-        $arg_list --mem $MEM_AVAILABLE
+    checkpoint=$CHECKPOINT_DIR/$(echo $arg_list | cut -d ' ' -f 2)
+    mkdir -p $checkpoint
+    resume=""
+    if ls $checkpoint/*.ckpt > /dev/null 2>&1; then
+        resume="--resume"
+    fi
+    mpiexec -n $NUM_NODES --map-by ppr:1:node --hostfile $OAR_NODEFILE ./mitm_parallel \
+        $arg_list --threads $NUM_THREADS --mem $MEM_AVAILABLE --checkpoint $checkpoint \
+        --checkpoint-interval $CHECKPOINT_INTERVAL $resume
 done
@@ -5,15 +5,15 @@
  * Implementation of the MitM distributed algorithm with a compression strategy
  * that can use less memory than the required by the sequential version.
  *
- * If you wish to optimize the memory allocation (i.e. equally distribute it
- * between processes), you must ensure that cores are evenly distributed in
- * a multinode topology. For instance, if you run the code for 128 cores on
- * 8 nodes, you should put 16 cores per node:
+ * Any number of processes can be used. The processes get shards of the same
+ * size, so if you wish to optimize the memory allocation you must ensure that
+ * cores are evenly distributed in a multinode topology. For instance, if you
+ * run the code for 128 cores on 8 nodes, you should put 16 cores per node:
  *
  *     mpiexec -n 128 --map-by ppr:16:node ./mitm_parallel ...
  *
- * This may slow down the code execution, but it also ensures that no memory
- * problems will ensue.
+ * Otherwise, --weight mem sizes the shard of each process after its share of
+ * the memory of its node.
  *
  * Additionally, the program has an early exit strategy, halting as soon as a
  * golden collision is found. It must be set during compilation time by
@@ -24,69 +24,171 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <assert.h>
 #include <getopt.h>
 #include <err.h>
 #include <math.h>
 #include <mpi.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_thread_num()    0
+#endif
 
 typedef uint64_t u64;       /* portable 64-bit integer */
 typedef uint32_t u32;       /* portable 32-bit integer */
-struct __attribute__ ((packed)) entry { u32 k; u64 v; };  /* hash table entry */
+typedef uint8_t u8;         /* portable 8-bit integer */
 
 /***************************** global variables ******************************/
 
 u64 n = 0;            /* block size (in bits) */
 u64 mask;             /* this is 2**n - 1 */
+int check_bits = 0;   /* bits of the second pair in the images (see f) */
+u64 image_mask;       /* this is 2**(n + check_bits) - 1 */
 
 u64 dict_size;         /* number of slots in the local hash table */
 u64 dict_size_global;  /* number of slots in the hash table */
-struct entry *A;       /* the hash table */
+u64 shard_start;       /* first slot of the local shard in the hash table */
+u64 *A;                /* the hash table (packed entries) */
+
+const char *dict_save_dir = NULL;   /* where shards are written, if any */
+const char *dict_load_dir = NULL;   /* where shards are mapped from, if any */
+const char *spill_dir = NULL;       /* where images are spilled, if any */
+const char *report_file = NULL;     /* where the run is reported, if any */
 
-/* (P, C) : two plaintext-ciphertext pairs */
-u32 P[2][2] = {{0, 0}, {0xffffffff, 0xffffffff}};
+/* (P, C) : two plaintext-ciphertext pairs; the plaintexts are constants, so
+   that the kernels are specialized for them */
+static const u32 P[2][2] = {{0, 0}, {0xffffffff, 0xffffffff}};
 u32 C[2][2];
 
+/* the (C0, C1) challenges, solved in turn with the same dictionary */
+#define MAX_SOLUTIONS           16
+
+struct challenge {
+    u32 C[2][2];
+    bool done;                  /* the search stopped early */
+    int nres;
+    u64 k1[MAX_SOLUTIONS], k2[MAX_SOLUTIONS];
+};
+
+struct challenge *challenges = NULL;
+int num_challenges = 0;
+
 /***************************** MPI settings *********************************/
 
 #define N_PROBES_MAX            256
+#define KEY_BATCH_SIZE          64       /* keys per f/g batch evaluation */
+#define CANDIDATE_BATCH_SIZE    64       /* candidates per batch verification */
+
+/* received elements whose slots are prefetched together */
+#ifndef PREFETCH_WINDOW
+#define PREFETCH_WINDOW         32
+#endif
 
 #define ROOT_RANK               0
 #define BUFFER_COUNT_MSG_SIZE   1
-#define BUFFER_ELEMENT_SIZE     2
 #define EARLY_EXIT_MSG_SIZE     1
+#define NUM_BUFFER_SETS         2        /* sets in the exchange pipeline */
+#define DONE_FLAG               (1ull << 63)  /* last exchange of a process */
+#define FOUND_FLAG              (1ull << 61)  /* the process found a solution */
+#define EXCHANGE_FLAGS          (DONE_FLAG | CHECKPOINT_FLAG | FOUND_FLAG)
+#ifndef BUFFER_RELATIVE_SIZE
 #define BUFFER_RELATIVE_SIZE    0.001    /* 0.1% of (local) dict size */
+#endif
 
 /* useful macros for compression algorithm */
 #define MIN(x, y)               (((x) < (y)) ? (x) : (y))
-#define GET_BUFFER_SIZE(b)      MIN(ceil(BUFFER_RELATIVE_SIZE * (b)), INT_MAX / BUFFER_ELEMENT_SIZE)
+#define MAX(x, y)               (((x) > (y)) ? (x) : (y))
+#define GET_BUFFER_SIZE(b)      MIN(ceil(BUFFER_RELATIVE_SIZE * (b)), INT_MAX / 2)
 #define GB                      1073741824
+#define DICT_SLOT_SIZE          8        /* bytes per slot, for all engines */
+#ifndef RELAXATION_FACTOR
 #define RELAXATION_FACTOR       1.25
+#endif
+#ifndef SLOTS_PER_ENTRY
+#define SLOTS_PER_ENTRY         1.125    /* the load of the tables is 1/1.125 */
+#endif
 
 #ifndef EARLY_EXIT
 #define EARLY_EXIT              0
 #endif
 
+/* send (key, value) elements in a single word when they fit */
+#ifndef PACKED_ELEMENTS
+#define PACKED_ELEMENTS         1
+#endif
+
 int num_processes, rank;
+int num_threads = 1;            /* worker threads per process */
+
+/* shards of the hash table, proportional to the weights of the processes */
+double shard_weight = 1;        /* relative weight of this process */
+bool weight_from_memory = false;    /* the weight is the memory per process */
+bool weighted_shards = false;   /* some processes have different weights */
+u64 *shard_starts;              /* first slot of each shard, then the size */
+
+/* a set of buffers, exchanged between processes in a single all-to-all */
+struct buffer_set {
+    u64 *send;                  /* elements to send to each process */
+    u64 *recv;                  /* elements received from each process */
+    u64 *send_counts;           /* counters for flushing/batch processing */
+    u64 *recv_counts;
+    int *send_sizes;            /* counters, as all-to-allv arguments */
+    int *recv_sizes;
+    MPI_Request requests[2];    /* all-to-alls of the counters and elements */
+    bool elements_posted;       /* the all-to-allv of elements has started */
+    int step;                   /* step of a two-level exchange */
+    bool all_done;              /* last exchange with elements */
+    bool any_found;             /* some process had found a solution */
+    bool checkpoint;            /* checkpoint once it is processed */
+    u64 *cursors;               /* keys of each thread sent up to this set */
+};
 
 u64 buffer_size;                /* number of elements in a single buffer */
-u64 *buffers;                   /* buffers for a process */
-u64 *buffers_counts;            /* counters for flushing/batch processing */
+int element_words = 2;          /* words per (key, value) element */
+u64 thread_buffer_size;         /* number of elements in a thread's slice */
+u64 buffer_fill;                /* elements of a slice that trigger an exchange */
+struct buffer_set buffer_sets[NUM_BUFFER_SETS];
+struct buffer_set *buffers;     /* set being filled by a process */
+int *buffers_displs;            /* offset of each buffer, in elements */
+MPI_Datatype element_type;      /* a (key, value) pair in the buffers */
+u64 *threads_counts;            /* counters of each thread's slices */
+
+/* phases of a sweep */
+enum phase { FILL, PROBE, WALK };
+
+enum exchange_mode { FLAT_EXCHANGE, HIER_EXCHANGE, RMA_EXCHANGE }
+    exchange_mode = FLAT_EXCHANGE;
 
 int compress_factor = 0;        /* to deal memory limitations */
+double memory_max = 0;          /* memory available, in GB (0 if unknown) */
 
 /* timers for performance evaluation */
 double compute_time = 0, communication_time = 0, fill_time = 0, probe_time = 0;
+double reset_time = 0;
+u64 fill_keys = 0, probe_keys = 0;  /* keys swept by the fills, and the probes
+                                       (or walks) */
 
 /* variables to measure the buffer efficiency */
 int num_exchanges = 0;
 double cum_buffer_occupancy = 0;
+u64 elements_sent = 0;
+u64 elements_capacity = 0;      /* elements that the exchanges could carry */
 
 /************************ tools and utility functions *************************/
 
@@ -97,13 +199,6 @@ double wtime()
 	return (double)ts.tv_sec + ts.tv_usec / 1E6;
 }
 
-void time_comm(void (*f)())
-{
-    double tic = wtime();
-    (*f)();
-    communication_time += wtime() - tic;
-}
-
 // murmur64 hash functions, tailorized for 64-bit ints / Cf. Daniel Lemire
 u64 murmur64(u64 x)
 {
@@ -115,6 +210,17 @@ u64 murmur64(u64 x)
     return x;
 }
 
+/* inverse of murmur64 (x ^= x >> 33 is an involution) */
+u64 murmur64_inverse(u64 x)
+{
+    x ^= x >> 33;
+    x *= 0x9cb4b2f8129337dbull;
+    x ^= x >> 33;
+    x *= 0x4f74430c22a54005ull;
+    x ^= x >> 33;
+    return x;
+}
+
 /* represent n in 4 bytes */
 void human_format(u64 n, char *target)
 {
@@ -140,8 +246,273 @@ void human_format(u64 n, char *target)
     }
 }
 
+/********************************* telemetry **********************************/
+
+/*
+ * Counters and timers of each process, reduced to their min, mean and max at
+ * the end of the run (see print_telemetry), so that stragglers and imbalanced
+ * shards show up. Each thread counts in its own cache line. The lengths of
+ * the probes of the dictionary are on the hot path, so they are only counted
+ * when compiled with -DTELEMETRY=1.
+ *
+ * With --trace DIR, the threads also log timed events: the sweeps, and in
+ * their loops the computation of images, the processing of the received
+ * elements, the barriers and the exchanges. Each process writes them to
+ * DIR/trace-<rank>.json at the end of the run, in the Chrome trace format
+ * (chrome://tracing or ui.perfetto.dev). Without --trace, an event costs a
+ * test, and there are a few of them per exchange.
+ */
+#ifndef TELEMETRY
+#define TELEMETRY               0       /* 1 counts the probe lengths */
+#endif
+#define PROBE_LENGTH_BINS       12      /* 1, 2-3, 4-7, ..., 2048 or more */
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS            (1 << 18)   /* events kept per thread */
+#endif
+
+/* counters of a thread */
+struct thread_telemetry {
+    u64 candidates;             /* pairs checked with is_good_pair */
+    u64 good_pairs;             /* ... that were solutions */
+    double verify_time;         /* seconds spent verifying them */
+    u64 probes;                 /* probes of the dictionary */
+    u64 probe_slots;            /* slots (buckets) they read */
+    u64 probe_lengths[PROBE_LENGTH_BINS];   /* probes per log2 of length */
+} __attribute__((aligned(64)));
+
+/* events of the traces; the sweeps are logged with their phase */
+enum trace_kind { TRACE_COMPUTE = WALK + 1, TRACE_DRAIN, TRACE_BARRIER,
+                  TRACE_WAIT, TRACE_EXCHANGE, TRACE_RESET };
+const char *trace_names[] = {"fill", "probe", "walk", "compute", "drain",
+                             "barrier", "exchange wait", "exchange", "reset"};
+
+struct trace_event {
+    int kind;
+    double start, end;
+};
+
+/* events logged by a thread */
+struct trace_log {
+    struct trace_event *events;
+    u64 count;
+    u64 dropped;                /* events beyond TRACE_EVENTS */
+} __attribute__((aligned(64)));
+
+const char *trace_dir = NULL;   /* where the traces are written, if any */
+struct thread_telemetry *thread_telemetry;
+struct trace_log *trace_logs;
+double trace_origin;            /* time 0 of the traces */
+
+/* Allocate the counters (and the event logs) of the threads. */
+void setup_telemetry()
+{
+    thread_telemetry = aligned_alloc(64, sizeof(*thread_telemetry) * num_threads);
+    trace_logs = aligned_alloc(64, sizeof(*trace_logs) * num_threads);
+    if (thread_telemetry == NULL || trace_logs == NULL)
+        err(1, "impossible to allocate the telemetry");
+    memset(thread_telemetry, 0, sizeof(*thread_telemetry) * num_threads);
+    memset(trace_logs, 0, sizeof(*trace_logs) * num_threads);
+    for (int t = 0; trace_dir != NULL && t < num_threads; t++) {
+        trace_logs[t].events = malloc(sizeof(struct trace_event) * TRACE_EVENTS);
+        if (trace_logs[t].events == NULL)
+            err(1, "impossible to allocate the traces");
+    }
+    if (trace_dir != NULL)
+        MPI_Barrier(MPI_COMM_WORLD);
+    trace_origin = wtime();
+}
+
+/* Zero the counters, e.g. after the calibration. */
+void reset_telemetry()
+{
+    memset(thread_telemetry, 0, sizeof(*thread_telemetry) * num_threads);
+}
+
+/* Start time of an event (0 if not tracing). */
+static inline double trace_clock()
+{
+    return (trace_dir != NULL) ? wtime() : 0;
+}
+
+/* Log an event of the calling thread, from `start` (see trace_clock) to
+   now. */
+static inline void trace_event(int kind, double start)
+{
+    if (trace_dir == NULL)
+        return;
+    struct trace_log *log = &trace_logs[omp_get_thread_num()];
+    if (log->count == TRACE_EVENTS) {
+        log->dropped += 1;
+        return;
+    }
+    struct trace_event *e = &log->events[log->count++];
+    e->kind = kind;
+    e->start = start;
+    e->end = wtime();
+}
+
+/* Count a probe of the dictionary that read `length` slots (or buckets). */
+static inline void count_probe(u64 length)
+{
+    struct thread_telemetry *t = &thread_telemetry[omp_get_thread_num()];
+    t->probes += 1;
+    t->probe_slots += length;
+    t->probe_lengths[MIN(63 - __builtin_clzll(length), PROBE_LENGTH_BINS - 1)] += 1;
+}
+
+/* Count `count` candidate pairs verified in `seconds`, `good` of which were
+   solutions. */
+static inline void count_candidates(u64 count, u64 good, double seconds)
+{
+    struct thread_telemetry *t = &thread_telemetry[omp_get_thread_num()];
+    t->candidates += count;
+    t->good_pairs += good;
+    t->verify_time += seconds;
+}
+
+/* Write the events of the threads to the trace of the process. */
+void write_trace()
+{
+    if (trace_dir == NULL)
+        return;
+    char name[4096];
+    snprintf(name, sizeof(name), "%s/trace-%d.json", trace_dir, rank);
+    FILE *file = fopen(name, "w");
+    if (file == NULL)
+        err(1, "impossible to open %s", name);
+
+    u64 dropped = 0;
+    fprintf(file, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+            "\"args\": {\"name\": \"rank %d\"}}", rank, rank);
+    for (int t = 0; t < num_threads; t++) {
+        const struct trace_log *log = &trace_logs[t];
+        for (u64 i = 0; i < log->count; i++) {
+            const struct trace_event *e = &log->events[i];
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+                    "\"tid\": %d, \"ts\": %.1f, \"dur\": %.1f}",
+                    trace_names[e->kind], rank, t,
+                    (e->start - trace_origin) * 1e6, (e->end - e->start) * 1e6);
+        }
+        dropped += log->dropped;
+    }
+    fprintf(file, "\n]\n");
+    if (fclose(file) != 0)
+        err(1, "impossible to write %s", name);
+    if (dropped > 0)
+        warnx("process %d dropped %" PRIu64 " events of its trace (more than "
+              "%d per thread)", rank, dropped, TRACE_EVENTS);
+}
+
+/****************************** memory allocation *****************************/
+
+/*
+ * The large tables (dictionary, buffers) are mapped on huge pages, so that the
+ * random accesses of the inserts and probes miss less in the TLB: 1GB pages
+ * for tables of several GB, 2MB pages otherwise, taken from the pool reserved
+ * in the kernel. When the pool is empty, the table gets normal pages and the
+ * kernel is advised to back it with transparent huge pages instead. The pages
+ * are not touched here but first by the threads, in parallel (first-touch
+ * policy). The send slices of a thread are only written by it, so they are
+ * placed on its NUMA node. The dictionary is accessed at hashed positions by
+ * all threads, so its static-schedule touch (the reset) only interleaves its
+ * pages across the nodes of the threads.
+ */
+#ifndef HUGE_PAGES
+#define HUGE_PAGES              1
+#endif
+#define HUGE_PAGE_2MB           (1ull << 21)
+#define HUGE_PAGE_1GB           (1ull << 30)
+
+enum page_kind { NORMAL_PAGES, TRANSPARENT_HUGE_PAGES, HUGE_PAGES_2MB,
+                 HUGE_PAGES_1GB };
+const char *page_kind_names[] = {"normal", "transparent huge", "2MB huge",
+                                 "1GB huge"};
+
+/* Map `bytes` of anonymous memory, rounded up to pages of `page` bytes. */
+static void *map_pages(u64 bytes, u64 page, int flags)
+{
+    u64 size = (bytes + page - 1) / page * page;
+    return mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+/* Do pages of `page` bytes waste less than 1/16 of a table of `bytes`? */
+static inline bool fits_pages(u64 bytes, u64 page)
+{
+    return bytes >= page && (page - bytes % page) % page <= bytes / 16;
+}
+
+/* Allocate `bytes` for a large table on the largest pages available, and
+   write their kind in `kind` (if not NULL). Return NULL on failure. */
+void *alloc_table(u64 bytes, enum page_kind *kind)
+{
+    void *p = MAP_FAILED;
+    enum page_kind k = NORMAL_PAGES;
+#if HUGE_PAGES && defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    if (fits_pages(bytes, HUGE_PAGE_1GB)) {
+        p = map_pages(bytes, HUGE_PAGE_1GB, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT));
+        k = HUGE_PAGES_1GB;
+    }
+    if (p == MAP_FAILED && fits_pages(bytes, HUGE_PAGE_2MB)) {
+        p = map_pages(bytes, HUGE_PAGE_2MB, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT));
+        k = HUGE_PAGES_2MB;
+    }
+#endif
+    if (p == MAP_FAILED) {
+        k = NORMAL_PAGES;
+        p = map_pages(MAX(bytes, 1), 1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+#if HUGE_PAGES && defined(MADV_HUGEPAGE)
+        if (bytes >= HUGE_PAGE_2MB && madvise(p, bytes, MADV_HUGEPAGE) == 0)
+            k = TRANSPARENT_HUGE_PAGES;
+#endif
+    }
+    if (kind != NULL)
+        *kind = k;
+    return p;
+}
+
+/* Touch the pages of a table in parallel, with a static schedule, which
+   interleaves them across the nodes of the threads. */
+void first_touch(void *table, u64 bytes)
+{
+    char *t = table;
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (u64 i = 0; i < bytes; i += 4096)
+        t[i] = 0;
+}
+
+/******************************** cipher backend ******************************/
+
+/*
+ * The MitM engine only sees the cipher through f, g and is_good_pair (see
+ * "MITM problem"), and the batch kernels of struct mitm_kernel. They are
+ * provided by the backend selected at compile time with -DCIPHER=..., which
+ * specializes them for the problem: the key is (k, 0...) with k < 2**n, and
+ * the plaintexts P are constants. A backend defines CIPHER_NAME, its scalar
+ * f, g and is_good_pair and its kernels, from the fastest to the slowest.
+ * Speck64/128 is the only backend so far.
+ */
+#define SPECK64_128             1
+
+#ifndef CIPHER
+#define CIPHER                  SPECK64_128
+#endif
+#if CIPHER != SPECK64_128
+#error "unknown CIPHER (SPECK64_128)"
+#endif
+
+/* checks of the hot paths, e.g. that f and g get keys of n bits */
+#ifndef DEBUG_CHECKS
+#define DEBUG_CHECKS            0
+#endif
+
 /******************************** SPECK block cipher **************************/
 
+#define CIPHER_NAME             "Speck64/128"
+#define SPECK_ROUNDS            27
+
 #define ROTL32(x,r) (((x)<<(r)) | (x>>(32-(r))))
 #define ROTR32(x,r) (((x)>>(r)) | ((x)<<(32-(r))))
 
@@ -174,279 +545,3517 @@ void Speck64128Decrypt(u32 Pt[], const u32 Ct[], u32 const rk[])
         DR32(Pt[1],Pt[0],rk[i--]);
 }
 
+/*
+ * Speck64/128 with the key (k, 0), i.e. its two high words are zero. The
+ * encryption computes the round keys on the fly instead of storing them, and
+ * the constant words (and plaintexts) are folded once the rounds are
+ * unrolled. The decryption needs the round keys in reverse order.
+ */
+static inline void speck_encrypt_key64(const u32 Pt[], u32 Ct[], u64 k)
+{
+    u32 A = k, B = k >> 32, C = 0, D = 0;
+    u32 x = Pt[1], y = Pt[0];
+    for (u32 i = 0; i < SPECK_ROUNDS;) {
+        ER32(x, y, A); ER32(B, A, i); i++;
+        ER32(x, y, A); ER32(C, A, i); i++;
+        ER32(x, y, A); ER32(D, A, i); i++;
+    }
+    Ct[0] = y;
+    Ct[1] = x;
+}
+
+/* Encrypt both plaintexts Pt[0] and Pt[1] with the same key, as above. */
+static inline void speck_encrypt2_key64(const u32 Pt[2][2], u32 Ct0[],
+                                        u32 Ct1[], u64 k)
+{
+    u32 A = k, B = k >> 32, C = 0, D = 0;
+    u32 x0 = Pt[0][1], y0 = Pt[0][0], x1 = Pt[1][1], y1 = Pt[1][0];
+    for (u32 i = 0; i < SPECK_ROUNDS;) {
+        ER32(x0, y0, A); ER32(x1, y1, A); ER32(B, A, i); i++;
+        ER32(x0, y0, A); ER32(x1, y1, A); ER32(C, A, i); i++;
+        ER32(x0, y0, A); ER32(x1, y1, A); ER32(D, A, i); i++;
+    }
+    Ct0[0] = y0;
+    Ct0[1] = x0;
+    Ct1[0] = y1;
+    Ct1[1] = x1;
+}
+
+static inline void speck_key_schedule_key64(u64 k, u32 rk[])
+{
+    u32 A = k, B = k >> 32, C = 0, D = 0;
+    for (u32 i = 0; i < SPECK_ROUNDS;) {
+        rk[i] = A; ER32(B, A, i); i++;
+        rk[i] = A; ER32(C, A, i); i++;
+        rk[i] = A; ER32(D, A, i); i++;
+    }
+}
+
 /******************************** dictionary ********************************/
 
 /*
  * "classic" hash table for 64-bit key-value pairs, with linear probing.
  * It operates under the assumption that the keys are somewhat random 64-bit integers.
- * The keys are only stored modulo 2**32 - 5 (a prime number), and this can lead
+ *
+ * Each entry packs a value and a fingerprint of its key in 64 bits. In a given
+ * round, all the values inserted are the x such that x % 2**c = round, where c
+ * is the compression level, so only x >> c (value_bits = n - c bits) is stored
+ * and the round is added back when probing (except with --spill, where all
+ * the n bits are stored). The remaining high bits hold the low bits of
+ * murmur64(key), while its slot is reduced from the high bits by a
+ * multiply-shift (see hash_slot), so that they are independent. This can lead
  * to some false positives.
+ *
+ * The top epoch_bits of the fingerprint are replaced by the epoch of the
+ * round, and only the entries of the current epoch are used: the others are
+ * empty slots. Starting a new round thus only increments the epoch, and the
+ * slots are emptied once every 2**epoch_bits - 1 rounds, when it wraps around.
+ * The all-ones epoch is never used, so that no entry is EMPTY.
  */
-static const u32 EMPTY = 0xffffffff;
-static const u64 PRIME = 0xfffffffb;
+static const u64 EMPTY = 0xffffffffffffffff;
+static const int MIN_FINGERPRINT_BITS = 8;
 
-/* allocate a hash table with `size` slots (12*size bytes) */
-void dict_setup(u64 size)
+int value_shift;       /* low bits of the values implied by the round */
+int value_bits;        /* bits of the stored values, i.e. n - value_shift */
+u64 value_mask;        /* this is 2**value_bits - 1 */
+u64 dict_round;        /* round of the values stored in the dictionary */
+int epoch_bits;        /* bits of the epoch in the entries (at least 1) */
+u64 dict_epoch;        /* epoch of the entries of the current round */
+u64 dict_epochs;       /* epochs before the slots must be emptied */
+enum page_kind dict_pages;  /* pages backing the dictionary */
+
+/* set the geometry of a hash table with `size` slots */
+void linear_dict_set_size(u64 size)
 {
 	dict_size = size;
+}
 
-	A = malloc(sizeof(*A) * dict_size);
+/* allocate a hash table with `size` slots (8*size bytes) */
+void linear_dict_setup(u64 size)
+{
+	A = alloc_table(sizeof(*A) * size, &dict_pages);
 	if (A == NULL)
 		err(1, "impossible to allocate the dictionary");
+}
+
+/* empty all the slots of the hash table (in parallel, see alloc_table) */
+void linear_dict_reset()
+{
+	#pragma omp parallel for num_threads(num_threads) schedule(static)
 	for (u64 i = 0; i < dict_size; i++)
-		A[i].k = EMPTY;
+		A[i] = EMPTY;
 }
 
-/* Insert the binding key |----> value in the dictionary */
-void dict_insert(u64 key, u64 value)
+/* Slot of a key whose hash is h in the global table: (h * dict_size_global)
+   / 2**64, a range reduction without division, from the high bits of h. */
+static inline u64 hash_slot(u64 h)
+{
+    return ((unsigned __int128) h * dict_size_global) >> 64;
+}
+
+/* Fingerprint of a key whose hash is h, from its low bits. It is never all
+   ones, so that no entry is EMPTY. */
+static inline u64 dict_fingerprint(u64 h)
+{
+    u64 fp = h & (EMPTY >> value_bits);
+    return (fp == EMPTY >> value_bits) ? fp - 1 : fp;
+}
+
+/* Is the entry e live, i.e. written in the current epoch? */
+static inline bool linear_live(u64 e)
+{
+    return e >> (64 - epoch_bits) == dict_epoch;
+}
+
+/* High bits of the entries of a key whose hash is h: the current epoch
+   followed by the fingerprint of the key. */
+static inline u64 linear_entry_tag(u64 h)
+{
+    u64 fp = dict_fingerprint(h) & (EMPTY >> (value_bits + epoch_bits));
+    return (dict_epoch << (64 - value_bits - epoch_bits)) | fp;
+}
+
+/* Atomically claim the free slot h, holding `expected`, for the entry e, since
+   the threads of a process insert concurrently in the same dictionary. */
+static inline bool dict_claim_slot(u64 h, u64 expected, u64 e)
+{
+    return __atomic_compare_exchange_n(&A[h], &expected, e, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/* address of the home slot of a key whose hash is `hash` */
+const void *linear_dict_slot(u64 hash)
+{
+    return &A[hash_slot(hash) - shard_start];
+}
+
+/* Insert the binding key |----> value in the dictionary, where `hash` is
+   murmur64(key) */
+void linear_dict_insert(u64 hash, u64 value)
 {
-    u64 h = murmur64(key) % dict_size_global - rank * dict_size;
+    u64 e = (linear_entry_tag(hash) << value_bits) | (value >> value_shift);
+    u64 h = hash_slot(hash) - shard_start;
     for (;;) {
-        if (A[h].k == EMPTY)
+        u64 old = A[h];
+        if (!linear_live(old) && dict_claim_slot(h, old, e))
             break;
         h += 1;
         if (h == dict_size)
             h = 0;
     }
-    assert(A[h].k == EMPTY);
-    A[h].k = key % PRIME;
-    A[h].v = value;
 }
 
-/* Query the dictionary with this `key`.  Write values (potentially)
- *  matching the key in `values` and return their number. The `values`
- *  array must be preallocated of size (at least) `maxval`.
+/* Query the dictionary with the key whose hash is `hash`.  Write values
+ *  (potentially) matching the key in `values` and return their number. The
+ *  `values` array must be preallocated of size (at least) `maxval`.
  *  The function returns -1 if there are more than `maxval` results.
  */
-int dict_probe(u64 key, int maxval, u64 values[])
+int linear_dict_probe(u64 hash, int maxval, u64 values[])
 {
-    u32 k = key % PRIME;
-    u64 h = murmur64(key) % dict_size_global - rank * dict_size;
+    u64 tag = linear_entry_tag(hash);
+    u64 h = hash_slot(hash) - shard_start, home = h;
     int nval = 0;
+    /* The clusters are long, so the high bits of the entries are compared
+       without shifts: e has the high bits t iff (e ^ t) < 2**low_bits. The
+       globals are kept in registers, since the stores in `values` may alias
+       them. */
+    const u64 *table = A;
+    const u64 size = dict_size;
+    const u64 epoch_high = dict_epoch << (64 - epoch_bits);
+    const u64 epoch_limit = 1ull << (64 - epoch_bits);
+    const u64 tag_high = tag << value_bits, tag_limit = 1ull << value_bits;
     for (;;) {
-        if (A[h].k == EMPTY)
-            return nval;
-        if (A[h].k == k) {
+        u64 e = table[h];
+        if ((e ^ epoch_high) >= epoch_limit)
+            break;
+        if ((e ^ tag_high) < tag_limit) {
         	if (nval == maxval)
         		return -1;
-            values[nval] = A[h].v;
+            values[nval] = ((e & value_mask) << value_shift) | dict_round;
             nval += 1;
         }
         h += 1;
-        if (h == dict_size)
+        if (h == size)
             h = 0;
    	}
+    if (TELEMETRY)
+        count_probe((h + size - home) % size + 1);
+    return nval;
 }
 
-/***************************** MITM problem ***********************************/
+/*
+ * Bucketized hash table, with the same 8 bytes per slot. Each bucket fills a
+ * cache line with a group of 8 one-byte tags followed by 8 entries of 7 bytes
+ * (Swiss table style). A tag has its high bit set when the slot is used, then
+ * the epoch (as above) and bits of murmur64(key), so that a single SIMD
+ * compare finds the candidate slots of a bucket. Entries pack the value as
+ * above with the low 56 - value_bits bits of the hash, and the tags take the
+ * next ones, all below the bits that select the bucket. Full buckets overflow
+ * in the next one.
+ */
+#define BUCKET_SLOTS            8
+#define BUCKET_ENTRY_SIZE       7
+#define BUCKET_ENTRY_MASK       ((1ull << (8 * BUCKET_ENTRY_SIZE)) - 1)
 
-/* f : {0, 1}^n --> {0, 1}^n.  Speck64-128 encryption of P[0], using k */
-u64 f(u64 k)
+static const u8 EMPTY_TAG = 0;
+
+struct bucket {
+    u8 tags[BUCKET_SLOTS];
+    u8 entries[BUCKET_SLOTS][BUCKET_ENTRY_SIZE];
+};
+
+struct bucket *buckets;     /* the bucketized hash table */
+u64 num_buckets;            /* number of local buckets */
+
+/* set the geometry of a bucketized hash table with `size` slots */
+void bucket_dict_set_size(u64 size)
 {
-    assert((k & mask) == k);
-    u32 K[4] = {k & 0xffffffff, k >> 32, 0, 0};
-    u32 rk[27];
-    Speck64128KeySchedule(K, rk);
-    u32 Ct[2];
-    Speck64128Encrypt(P[0], Ct, rk);
-    return ((u64) Ct[0] ^ ((u64) Ct[1] << 32)) & mask;
+    dict_size = size;
+    num_buckets = size / BUCKET_SLOTS;
 }
 
-/* g : {0, 1}^n --> {0, 1}^n.  speck64-128 decryption of C[0], using k */
-u64 g(u64 k)
+/* allocate a bucketized hash table with `size` slots (8*size bytes) */
+void bucket_dict_setup(u64 size)
 {
-    assert((k & mask) == k);
-    u32 K[4] = {k & 0xffffffff, k >> 32, 0, 0};
-    u32 rk[27];
-    Speck64128KeySchedule(K, rk);
-    u32 Pt[2];
-    Speck64128Decrypt(Pt, C[0], rk);
-    return ((u64) Pt[0] ^ ((u64) Pt[1] << 32)) & mask;
+    /* the pages are aligned, hence the buckets on cache lines */
+    buckets = alloc_table(sizeof(struct bucket) * (size / BUCKET_SLOTS),
+                          &dict_pages);
+    if (buckets == NULL)
+        err(1, "impossible to allocate the dictionary");
 }
 
-bool is_good_pair(u64 k1, u64 k2)
+/* empty all the buckets of the hash table (in parallel, see alloc_table) */
+void bucket_dict_reset()
 {
-    u32 Ka[4] = {k1 & 0xffffffff, k1 >> 32, 0, 0};
-    u32 Kb[4] = {k2 & 0xffffffff, k2 >> 32, 0, 0};
-    u32 rka[27];
-    u32 rkb[27];
-    Speck64128KeySchedule(Ka, rka);
-    Speck64128KeySchedule(Kb, rkb);
-    u32 mid[2];
-    u32 Ct[2];
-    Speck64128Encrypt(P[1], mid, rka);
-    Speck64128Encrypt(mid, Ct, rkb);
-    return (Ct[0] == C[1][0]) && (Ct[1] == C[1][1]);
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (u64 i = 0; i < num_buckets; i++)
+        memset(buckets[i].tags, EMPTY_TAG, BUCKET_SLOTS);
 }
 
-/***************************** MPI functions ***********************************/
-
-/* Allocate memory space for the buffers and the buffer counts. */
-void setup_buffers()
+/* high bits of the tags of the current epoch */
+static inline u8 bucket_epoch_tag()
 {
-    /* NOTE: The buffer_size describes the number of elements for ONE process.
-       Therefore, the total number of elements that a process may hold is
-       buffer_size * num_processes. */
-    buffer_size = GET_BUFFER_SIZE(dict_size);
-    buffers = malloc(sizeof(*buffers) * buffer_size * BUFFER_ELEMENT_SIZE * num_processes);
-    buffers_counts = malloc(sizeof(*buffers_counts) * num_processes);
-
-    for (int i = 0; i < num_processes; i++) {
-        buffers_counts[i] = 0;
-    }
+    return 0x80 | dict_epoch << (7 - epoch_bits);
 }
 
-/* Add an element to the buffer. Returns 1 if the element's buffer is full. */
-int add_to_buffer(u64 key, u64 val)
+/* tag of a key whose hash is h; its high bit is set so it is never empty */
+static inline u8 bucket_tag(u64 h)
 {
-    int h_rank = (murmur64(key) % dict_size_global) / dict_size;
-
-    buffers[2 * buffer_size * h_rank + 2 * buffers_counts[h_rank]] = key;
-    buffers[2 * buffer_size * h_rank + 2 * buffers_counts[h_rank] + 1] = val;
-    buffers_counts[h_rank]++;
+    return bucket_epoch_tag()
+           | ((h >> (56 - value_bits)) & (0x7f >> epoch_bits));
+}
 
-    return (buffers_counts[h_rank] == buffer_size)? 1 : 0;
+/* Bit mask of the slots of bucket b whose tag, restricted to `mask`, is `tag`. */
+static inline unsigned bucket_match(const struct bucket *b, u8 mask, u8 tag)
+{
+#ifdef __SSE2__
+    __m128i tags = _mm_loadl_epi64((const __m128i *) b->tags);
+    tags = _mm_and_si128(tags, _mm_set1_epi8(mask));
+    __m128i eq = _mm_cmpeq_epi8(tags, _mm_set1_epi8(tag));
+    return _mm_movemask_epi8(eq) & ((1 << BUCKET_SLOTS) - 1);
+#else
+    unsigned match = 0;
+    for (int i = 0; i < BUCKET_SLOTS; i++)
+        match |= ((b->tags[i] & mask) == tag) << i;
+    return match;
+#endif
 }
 
-/* Update the buffer occupancy counters. */
-void update_buffer_occupancy_statistics()
+/* mask of the high bits of the tags telling whether a slot is live */
+static inline u8 bucket_live_mask()
 {
-    u64 num_elements = 0;
-    for (int i = 0; i < num_processes; i++) {
-        num_elements += buffers_counts[i];
-    }
-    num_exchanges += 1;
-    cum_buffer_occupancy += (double) num_elements / (buffer_size * num_processes);
+    return 0xff << (7 - epoch_bits);
 }
 
-/* Exchange buffer sizes and buffers between processes. */
-void exchange_buffers()
+/* Bit mask of the free slots of bucket b, i.e. not written in this epoch. */
+static inline unsigned bucket_free(const struct bucket *b)
 {
-    update_buffer_occupancy_statistics();
-    MPI_Alltoall(MPI_IN_PLACE, BUFFER_COUNT_MSG_SIZE, MPI_UINT64_T,
-                 buffers_counts, BUFFER_COUNT_MSG_SIZE, MPI_UINT64_T,
-                 MPI_COMM_WORLD);
-    MPI_Alltoall(MPI_IN_PLACE, buffer_size * BUFFER_ELEMENT_SIZE,
-                 MPI_UINT64_T, buffers, buffer_size * BUFFER_ELEMENT_SIZE,
-                 MPI_UINT64_T, MPI_COMM_WORLD);
+    return ~bucket_match(b, bucket_live_mask(), bucket_epoch_tag())
+           & ((1 << BUCKET_SLOTS) - 1);
 }
 
-/* Insert elements from a buffer into the dict and flush the buffer. */
-void batch_insert()
+/* address of the home bucket of a key whose hash is `hash` */
+const void *bucket_dict_slot(u64 hash)
 {
-    u64 x, z;
+    return &buckets[(hash_slot(hash) - shard_start) / BUCKET_SLOTS];
+}
 
-    for (int i = 0; i < num_processes; i++) {
-        for (u64 e = 0; e < buffers_counts[i]; e++) {
-            z = buffers[buffer_size * BUFFER_ELEMENT_SIZE * i + BUFFER_ELEMENT_SIZE * e];
-            x = buffers[buffer_size * BUFFER_ELEMENT_SIZE * i + BUFFER_ELEMENT_SIZE * e + 1];
-            dict_insert(z, x);
+/* Insert the binding key |----> value in the bucketized dictionary, where
+   `hash` is murmur64(key) */
+void bucket_dict_insert(u64 hash, u64 value)
+{
+    u8 tag = bucket_tag(hash);
+    u64 e = ((hash << value_bits) & BUCKET_ENTRY_MASK) | (value >> value_shift);
+    u64 b = (hash_slot(hash) - shard_start) / BUCKET_SLOTS;
+    for (;;) {
+        unsigned slots = bucket_free(&buckets[b]);
+        while (slots) {
+            int i = __builtin_ctz(slots);
+            u8 expected = buckets[b].tags[i];
+            /* claim the slot atomically, as in linear_dict_insert */
+            if ((expected & bucket_live_mask()) != bucket_epoch_tag() &&
+                __atomic_compare_exchange_n(&buckets[b].tags[i], &expected, tag,
+                                            false, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                memcpy(buckets[b].entries[i], &e, BUCKET_ENTRY_SIZE);
+                return;
+            }
+            slots &= slots - 1;
         }
+        b += 1;
+        if (b == num_buckets)
+            b = 0;
     }
+}
 
-    /* reset buffers' counters */
-    for (int i = 0; i < num_processes; i++) {
-        buffers_counts[i] = 0;
+/* Query the bucketized dictionary, as linear_dict_probe. */
+int bucket_dict_probe(u64 hash, int maxval, u64 values[])
+{
+    u8 tag = bucket_tag(hash);
+    u64 fp = (hash << value_bits) & BUCKET_ENTRY_MASK;
+    u64 b = (hash_slot(hash) - shard_start) / BUCKET_SLOTS, home = b;
+    int nval = 0;
+    for (;;) {
+        unsigned match = bucket_match(&buckets[b], 0xff, tag);
+        while (match) {
+            int i = __builtin_ctz(match);
+            u64 e = 0;
+            memcpy(&e, buckets[b].entries[i], BUCKET_ENTRY_SIZE);
+            if ((e & ~value_mask) == fp) {
+                if (nval == maxval)
+                    return -1;
+                values[nval] = ((e & value_mask) << value_shift) | dict_round;
+                nval += 1;
+            }
+            match &= match - 1;
+        }
+        if (bucket_free(&buckets[b]))
+            break;
+        b += 1;
+        if (b == num_buckets)
+            b = 0;
     }
+    if (TELEMETRY)
+        count_probe((b + num_buckets - home) % num_buckets + 1);
+    return nval;
 }
 
-/* Check if a solution has been found, resulting in an early exit. */
-int solution_found(int nres)
+/* available dictionary engines, sharing the same API */
+struct dict_engine {
+    const char *name;
+    void **table;               /* storage, of DICT_SLOT_SIZE bytes per slot */
+    int epoch_bits;             /* bits of the epoch in the slots */
+    int entry_bits;             /* bits for the values and fingerprints */
+    void (*set_size)(u64 size); /* geometry, also for mapped tables */
+    void (*setup)(u64 size);
+    void (*reset)();
+    const void *(*slot)(u64 hash);
+    void (*insert)(u64 hash, u64 value);
+    int (*probe)(u64 hash, int maxval, u64 values[]);
+};
+
+struct dict_engine dict_engines[] = {
+    {"linear", (void **) &A, 4, 64 - 4, linear_dict_set_size,
+     linear_dict_setup, linear_dict_reset, linear_dict_slot,
+     linear_dict_insert, linear_dict_probe},
+    {"bucket", (void **) &buckets, 3, 8 * BUCKET_ENTRY_SIZE, bucket_dict_set_size,
+     bucket_dict_setup, bucket_dict_reset, bucket_dict_slot,
+     bucket_dict_insert, bucket_dict_probe},
+};
+
+struct dict_engine *dict = &dict_engines[0];    /* selected engine */
+
+/* Select the dictionary engine called `name`. */
+void select_dict_engine(const char *name)
 {
-    int nres_global;
-    MPI_Allreduce(&nres, &nres_global, EARLY_EXIT_MSG_SIZE,
-                  MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-    return nres_global > 0;
+    int num_engines = sizeof(dict_engines) / sizeof(*dict_engines);
+    for (int i = 0; i < num_engines; i++)
+        if (strcmp(name, dict_engines[i].name) == 0) {
+            dict = &dict_engines[i];
+            return;
+        }
+    errx(1, "unknown dictionary %s", name);
 }
 
-/* Check elements of the buffer against the local dictionary. */
-u64 batch_probe(int *nres, int maxres, u64 k1[], u64 k2[])
+/* allocate an empty hash table with `size` slots (8*size bytes) */
+void dict_setup(u64 size)
 {
-    u64 y, z;
-    u64 x[N_PROBES_MAX];
-    u64 ncandidates_partial = 0;
+	dict->set_size(size);
+	value_shift = (spill_dir == NULL) ? compress_factor : 0;
+	value_bits = n - value_shift;
+	value_mask = (1ull << value_bits) - 1;
+	/* the fingerprints keep at least MIN_FINGERPRINT_BITS bits */
+	if (value_bits > dict->entry_bits - MIN_FINGERPRINT_BITS)
+		errx(1, "the values are too large for the %s dictionary entries",
+		     dict->name);
 
-    for (int i = 0; i < num_processes; i++) {
-        for (u64 e = 0; e < buffers_counts[i]; e++) {
-            y = buffers[buffer_size * BUFFER_ELEMENT_SIZE * i + BUFFER_ELEMENT_SIZE * e];
-            z = buffers[buffer_size * BUFFER_ELEMENT_SIZE * i + BUFFER_ELEMENT_SIZE * e + 1];
+	epoch_bits = dict->epoch_bits;
+	dict_epochs = (1ull << epoch_bits) - 1;
+	dict_epoch = 0;
 
-            int nx = dict_probe(y, N_PROBES_MAX, x);
-            assert(nx >= 0);
-            ncandidates_partial += nx;
-            for (int i = 0; i < nx; i++)
-                if (is_good_pair(x[i], z)) {
-                    if (*nres == maxres)
-                        return -1;
-                    k1[*nres] = x[i];
-                    k2[*nres] = z;
-                    *nres += 1;
-                }
-        }
-    }
+	/* loaded dictionaries are mapped for each round instead */
+	if (dict_load_dir == NULL) {
+		dict->setup(size);
+		dict->reset();
+	}
+}
 
-    for (int i = 0; i < num_processes; i++) {
-        buffers_counts[i] = 0;
+/* Empty the hash table in O(1): the entries of the previous epochs are stale,
+   and all the slots are only emptied when the epoch wraps around. */
+static inline void dict_reset()
+{
+    dict_epoch += 1;
+    if (dict_epoch == dict_epochs) {
+        dict->reset();
+        dict_epoch = 0;
     }
+}
 
-    return ncandidates_partial;
+/* Insert the binding key |----> value in the dictionary */
+static inline void dict_insert(u64 key, u64 value)
+{
+    dict->insert(murmur64(key), value);
 }
 
-/* Set compression factor based on maximum memory available. */
-void set_compression_factor(double memory_max)
+/* Query the dictionary with this `key` (see linear_dict_probe) */
+static inline int dict_probe(u64 key, int maxval, u64 values[])
 {
-    u64 dict_slots = 1.125 * (1ull << n) / num_processes;
-    u64 buffers_slots = GET_BUFFER_SIZE(dict_slots) *
-                        BUFFER_ELEMENT_SIZE * num_processes;
-    u64 memory_required = (dict_slots * sizeof(*A) +
-                           buffers_slots * sizeof(*buffers)) * num_processes;
-    // NOTE: We put RELAXATION_FACTOR times the memory requirement as to not
-    // overload the system
-    int minimum_slices = RELAXATION_FACTOR * ceil(memory_required / (memory_max * GB));
+    return dict->probe(murmur64(key), maxval, values);
+}
 
-    while ((1 << compress_factor) < minimum_slices) {
-        compress_factor++;
-    }
+/* Prefetch the slot where the key whose hash is `hash` will be inserted */
+static inline void dict_prefetch_insert(u64 hash)
+{
+    __builtin_prefetch(dict->slot(hash), 1);
 }
 
-/* Print execution info for easier debugging. */
-void print_execution_info()
+/* Prefetch the slot where the key whose hash is `hash` will be looked up */
+static inline void dict_prefetch_probe(u64 hash)
 {
-    if (rank == ROOT_RANK) {
-        printf("Running with n=%d, C0=(%08x, %08x) and C1=(%08x, %08x)\n",
-               (int) n, C[0][0], C[0][1], C[1][0], C[1][1]);
-        printf("Number of processes: %d\n", num_processes);
-        printf("Compression level: %d (%d rounds)\n", compress_factor,
-               1 << compress_factor);
+    __builtin_prefetch(dict->slot(hash), 0);
+}
 
-        char hdsize_global[8], hdsize[8];
+/*************************** persistent dictionary *****************************/
 
-        human_format(dict_size_global * sizeof(*A), hdsize_global);
-        human_format(dict_size * sizeof(*A), hdsize);
-        printf("Global dictionary size: %sB (%sB per process)\n",
-               hdsize_global, hdsize);
+/*
+ * f only depends on the fixed plaintext P[0], so the filled dictionary can be
+ * reused for any (C0, C1) challenge with the same n. With --save-dict DIR,
+ * each process writes its shard of each round to a file of DIR, made of a
+ * page-sized header followed by the raw slots of the engine. With --load-dict
+ * DIR, the fill phase is skipped and the shards are mapped read-only instead.
+ * The files are only valid for the same n, number of processes, engine,
+ * compression level (which --load-dict takes from the files) and check bits.
+ */
+#define DICT_FILE_MAGIC         "MITMDIC2"
+#define DICT_FILE_HEADER_SIZE   4096
 
-        human_format(GET_BUFFER_SIZE(dict_size) * BUFFER_ELEMENT_SIZE *
-                     num_processes * sizeof(*buffers) * num_processes,
-                     hdsize_global);
-        human_format(GET_BUFFER_SIZE(dict_size) * BUFFER_ELEMENT_SIZE *
-                     num_processes * sizeof(*buffers), hdsize);
-        printf("Total buffer size: %sB (%sB per process)\n",
-               hdsize_global, hdsize);
-    }
+struct dict_file_header {
+    char magic[8];
+    u32 n;
+    u32 compress_factor;
+    u32 round;
+    u32 rank;
+    u32 num_processes;
+    u32 P0[2];
+    char engine[16];
+    u64 dict_size;
+    u32 epoch;                  /* epoch of the entries of the round */
+    u32 epoch_bits;
+    u32 check_bits;             /* of the images hashed (see f) */
+};
+
+void *dict_mapping = NULL;          /* shard mapped for the current round */
+size_t dict_mapping_size;
+
+/* Name of the file holding the shard of this process for `round`. */
+void dict_file_name(const char *dir, int round, char *name, size_t size)
+{
+    snprintf(name, size, "%s/f-n%d-p%d-round%d-rank%d.dict", dir, (int) n,
+             num_processes, round, rank);
 }
 
-/* Print average buffer occupancy. */
-void print_average_buffer_occupancy()
+/* Write the shard of the dictionary filled in `round` to `dir`. */
+void save_dict(const char *dir, int round)
 {
-    if (rank == ROOT_RANK) {
-        MPI_Reduce(MPI_IN_PLACE, &cum_buffer_occupancy, 1, MPI_DOUBLE,
-                   MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
-        printf("Average buffer occupancy: %.2f%%\n",
-               cum_buffer_occupancy / (num_exchanges * num_processes) * 100);
-    } else {
-        MPI_Reduce(&cum_buffer_occupancy, &cum_buffer_occupancy, 1,
+    char name[4096];
+    dict_file_name(dir, round, name, sizeof(name));
+
+    struct dict_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DICT_FILE_MAGIC, sizeof(header.magic));
+    header.n = n;
+    header.compress_factor = compress_factor;
+    header.round = round;
+    header.rank = rank;
+    header.num_processes = num_processes;
+    header.P0[0] = P[0][0];
+    header.P0[1] = P[0][1];
+    strncpy(header.engine, dict->name, sizeof(header.engine) - 1);
+    header.dict_size = dict_size;
+    header.epoch = dict_epoch;
+    header.epoch_bits = epoch_bits;
+    header.check_bits = check_bits;
+
+    char page[DICT_FILE_HEADER_SIZE] = {0};
+    memcpy(page, &header, sizeof(header));
+
+    FILE *file = fopen(name, "wb");
+    if (file == NULL)
+        err(1, "impossible to create %s", name);
+    if (fwrite(page, sizeof(page), 1, file) != 1
+        || fwrite(*dict->table, DICT_SLOT_SIZE, dict_size, file) != dict_size
+        || fclose(file) != 0)
+        err(1, "impossible to write %s", name);
+}
+
+/* Read and check the header of the shard of `round` in `dir`, then return the
+   open file descriptor. */
+int open_dict_file(const char *dir, int round, struct dict_file_header *header)
+{
+    char name[4096];
+    dict_file_name(dir, round, name, sizeof(name));
+
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+        err(1, "impossible to open %s", name);
+    if (pread(fd, header, sizeof(*header), 0) != sizeof(*header))
+        err(1, "impossible to read %s", name);
+    if (memcmp(header->magic, DICT_FILE_MAGIC, sizeof(header->magic)) != 0)
+        errx(1, "%s is not a dictionary file of this version", name);
+    if (header->n != n || header->num_processes != (u32) num_processes
+        || header->rank != (u32) rank || header->round != (u32) round
+        || header->P0[0] != P[0][0] || header->P0[1] != P[0][1])
+        errx(1, "%s was written for another configuration", name);
+    if (strncmp(header->engine, dict->name, sizeof(header->engine)) != 0)
+        errx(1, "%s was written by the %s dictionary", name, header->engine);
+    if (header->epoch_bits != (u32) dict->epoch_bits)
+        errx(1, "%s was written without epochs, it must be saved again", name);
+    return fd;
+}
+
+/* Take the compression level from the shards of --load-dict. */
+void load_dict_compress_factor()
+{
+    struct dict_file_header header;
+    close(open_dict_file(dict_load_dir, 0, &header));
+    compress_factor = header.compress_factor;
+}
+
+/* Map the shard filled in `round` in place of the engine's table. */
+void load_dict(int round)
+{
+    struct dict_file_header header;
+    int fd = open_dict_file(dict_load_dir, round, &header);
+    if (header.dict_size != dict_size)
+        errx(1, "the dictionary files do not match the dictionary size");
+    if (header.check_bits != (u32) check_bits)
+        errx(1, "the dictionary files were written with %d check bits",
+             (int) header.check_bits);
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;      /* the probes access the whole shard */
+#endif
+    if (dict_mapping != NULL)
+        munmap(dict_mapping, dict_mapping_size);
+    dict_mapping_size = DICT_FILE_HEADER_SIZE + DICT_SLOT_SIZE * dict_size;
+    dict_mapping = mmap(NULL, dict_mapping_size, PROT_READ, flags, fd, 0);
+    if (dict_mapping == MAP_FAILED)
+        err(1, "impossible to map the dictionary");
+    close(fd);
+
+    *dict->table = (char *) dict_mapping + DICT_FILE_HEADER_SIZE;
+    dict_epoch = header.epoch;
+}
+
+/* Read the shard of `round` saved in `dir` into the engine's table. */
+void read_dict(const char *dir, int round)
+{
+    struct dict_file_header header;
+    int fd = open_dict_file(dir, round, &header);
+    if (header.dict_size != dict_size)
+        errx(1, "the dictionary files do not match the dictionary size");
+    if (header.check_bits != (u32) check_bits)
+        errx(1, "the dictionary files were written with %d check bits",
+             (int) header.check_bits);
+
+    char *table = *dict->table;
+    u64 size = DICT_SLOT_SIZE * dict_size, done = 0;
+    while (done < size) {
+        ssize_t r = pread(fd, table + done, size - done,
+                          DICT_FILE_HEADER_SIZE + done);
+        if (r <= 0)
+            err(1, "impossible to read the dictionary shard");
+        done += r;
+    }
+    close(fd);
+    dict_epoch = header.epoch;
+}
+
+/******************************** checkpoints *********************************/
+
+/*
+ * With --checkpoint DIR, each process saves the position of the search in its
+ * own file of DIR: the round, the challenge being probed, the cursors of its
+ * threads in the probe sweep and the solutions found so far. Checkpoints are
+ * written at the start of each round, after each fill when the shards are
+ * also saved (--checkpoint-dict), and every --checkpoint-interval seconds of
+ * probing. In the latter case, the root sets CHECKPOINT_FLAG in the counts of
+ * an exchange, and all processes write their file once they have processed
+ * this exchange, so the cursors only cover keys whose images were handled.
+ *
+ * Files alternate between two slots with a sequence number, and are renamed
+ * in place once complete. --resume restarts from the last sequence written by
+ * all processes, refilling the dictionary of the round if it was not saved.
+ */
+#define CHECKPOINT_MAGIC        "MITMCKPT"
+#define CHECKPOINT_FLAG         (1ull << 62)  /* checkpoint after an exchange */
+
+struct checkpoint_header {
+    char magic[8];
+    u64 sequence;
+    u32 n;
+    u32 compress_factor;
+    u32 num_processes;
+    u32 num_threads;
+    u32 num_challenges;
+    u32 rank;
+    u32 round;                  /* round in progress */
+    u32 filled;                 /* the dictionary of the round is filled */
+    u32 dict_saved;             /* ... and saved in the checkpoint dir */
+    u32 challenge;              /* challenge being probed */
+    u32 has_cursors;            /* the probe of the challenge has started */
+};
+
+const char *checkpoint_dir = NULL;
+double checkpoint_interval = 600;   /* seconds between checkpoints */
+bool checkpoint_dict = false;       /* save the shards with the checkpoints */
+bool resume = false;
+
+struct checkpoint_header position;  /* current position of the search */
+u64 *resume_cursors = NULL;         /* where the threads resume the probe */
+double last_checkpoint, checkpoint_time = 0;
+
+/* Name of the checkpoint file of this process in slot `slot`. */
+void checkpoint_file_name(int slot, char *name, size_t size)
+{
+    snprintf(name, size, "%s/checkpoint-p%d-rank%d-%d.ckpt", checkpoint_dir,
+             num_processes, rank, slot);
+}
+
+/* Is a periodic checkpoint due? */
+bool checkpoint_due()
+{
+    return checkpoint_dir != NULL
+           && wtime() - last_checkpoint >= checkpoint_interval;
+}
+
+/* Save the current position, with the probe `cursors` of the threads if the
+   probe of the current challenge has started. */
+void write_checkpoint(const u64 cursors[])
+{
+    double start = wtime();
+    char name[4096], tmp[4112];
+
+    position.sequence += 1;
+    position.has_cursors = (cursors != NULL);
+    checkpoint_file_name(position.sequence % 2, name, sizeof(name));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+    FILE *file = fopen(tmp, "wb");
+    if (file == NULL)
+        err(1, "impossible to create %s", tmp);
+    bool ok = fwrite(&position, sizeof(position), 1, file) == 1;
+    if (cursors != NULL)
+        ok &= fwrite(cursors, sizeof(*cursors), num_threads, file)
+              == (size_t) num_threads;
+    ok &= fwrite(challenges, sizeof(*challenges), num_challenges, file)
+          == (size_t) num_challenges;
+    ok &= fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !ok || rename(tmp, name) != 0)
+        err(1, "impossible to write %s", name);
+
+    last_checkpoint = wtime();
+    checkpoint_time += last_checkpoint - start;
+}
+
+/* Read the checkpoint of slot `slot` if it is valid for this run. Returns its
+   sequence number (0 if it cannot be used), and the cursors and challenges
+   if `cursors` is not NULL. */
+u64 read_checkpoint(int slot, struct checkpoint_header *header, u64 cursors[])
+{
+    char name[4096];
+    checkpoint_file_name(slot, name, sizeof(name));
+
+    FILE *file = fopen(name, "rb");
+    if (file == NULL)
+        return 0;
+    if (fread(header, sizeof(*header), 1, file) != 1
+        || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) {
+        fclose(file);
+        return 0;
+    }
+    if (header->n != n || header->num_processes != (u32) num_processes
+        || header->num_threads != (u32) num_threads
+        || header->num_challenges != (u32) num_challenges
+        || header->rank != (u32) rank)
+        errx(1, "%s was written for another configuration", name);
+    if (header->compress_factor != (u32) compress_factor)
+        errx(1, "%s was written with compression level %d (use the same --mem)",
+             name, header->compress_factor);
+
+    if (cursors != NULL) {
+        struct challenge saved[num_challenges];
+        if ((header->has_cursors
+             && fread(cursors, sizeof(*cursors), num_threads, file)
+                != (size_t) num_threads)
+            || fread(saved, sizeof(*saved), num_challenges, file)
+               != (size_t) num_challenges)
+            errx(1, "%s is truncated", name);
+        for (int i = 0; i < num_challenges; i++) {
+            if (memcmp(saved[i].C, challenges[i].C, sizeof(saved[i].C)) != 0)
+                errx(1, "%s was written for other challenges", name);
+            challenges[i] = saved[i];
+        }
+    }
+    fclose(file);
+    return header->sequence;
+}
+
+/* Restore the last checkpoint written by all processes. */
+void resume_from_checkpoint()
+{
+    struct checkpoint_header header;
+    u64 sequences[2], latest, common;
+
+    for (int slot = 0; slot < 2; slot++)
+        sequences[slot] = read_checkpoint(slot, &header, NULL);
+    latest = MAX(sequences[0], sequences[1]);
+    MPI_Allreduce(&latest, &common, 1, MPI_UINT64_T, MPI_MIN, MPI_COMM_WORLD);
+    if (common == 0)
+        errx(1, "no checkpoint to resume from in %s", checkpoint_dir);
+
+    int slot = common % 2;
+    resume_cursors = malloc(sizeof(*resume_cursors) * num_threads);
+    if (resume_cursors == NULL)
+        err(1, "impossible to allocate the cursors");
+    if (sequences[slot] != common
+        || read_checkpoint(slot, &position, resume_cursors) != common)
+        errx(1, "the checkpoint %" PRIu64 " is missing", common);
+    if (!position.has_cursors) {
+        free(resume_cursors);
+        resume_cursors = NULL;
+    }
+    if (rank == ROOT_RANK)
+        printf("Resuming from checkpoint %" PRIu64 " (round %d, challenge %d)\n",
+               common, position.round, position.challenge);
+}
+
+/* Start the checkpoints of a new search. */
+void setup_checkpoints()
+{
+    memset(&position, 0, sizeof(position));
+    memcpy(position.magic, CHECKPOINT_MAGIC, sizeof(position.magic));
+    position.n = n;
+    position.compress_factor = compress_factor;
+    position.num_processes = num_processes;
+    position.num_threads = num_threads;
+    position.num_challenges = num_challenges;
+    position.rank = rank;
+    last_checkpoint = wtime();
+    if (resume)
+        resume_from_checkpoint();
+}
+
+/***************************** MITM problem ***********************************/
+
+/*
+ * Beyond n = 32, the images of f and g carry check bits from the second pair:
+ * they are the n + check_bits low bits of E(P[0]) ^ (E(P[1]) << n) for f, and
+ * of D(C[0]) ^ (D(C[1]) << n) for g, where E and D encrypt and decrypt with
+ * the key k. A solution still has f(k1) == g(k2), but the other collisions on
+ * the first pair (about one per key of g) only match with probability
+ * 2**-check_bits, so that almost no candidate is left to verify. The owner,
+ * slot and fingerprint of an image all come from its hash, so the check bits
+ * need no room in the entries, nor in the elements (two words when n > 32).
+ *
+ * The second block shares the key schedule of the first, which adds about
+ * half an evaluation of f or g. Per round, f and g are evaluated on 2**(n-c)
+ * and 2**n keys and 2**(n-c) candidates are verified (two encryptions each),
+ * so the check bits pay when 2**c < 3, and always with --spill, where g is
+ * only evaluated once per key.
+ */
+#ifndef CHECK_BITS
+#define CHECK_BITS              16      /* 0 disables the check bits */
+#endif
+#define CHECK_MAX_COMPRESSION   1
+
+/* The image of the blocks b0 and b1 (see above). */
+static inline u64 check_image(u64 b0, u64 b1)
+{
+    return (b0 ^ (b1 << n)) & image_mask;
+}
+
+/* f : {0, 1}^n --> {0, 1}^n.  Speck64-128 encryption of P[0], using k */
+u64 f(u64 k)
+{
+    if (DEBUG_CHECKS)
+        assert((k & mask) == k);
+    u32 Ct[2];
+    if (check_bits == 0) {
+        speck_encrypt_key64(P[0], Ct, k);
+        return ((u64) Ct[0] ^ ((u64) Ct[1] << 32)) & mask;
+    }
+    u32 Ct1[2];
+    speck_encrypt2_key64(P, Ct, Ct1, k);
+    return check_image((u64) Ct[0] ^ ((u64) Ct[1] << 32),
+                       (u64) Ct1[0] ^ ((u64) Ct1[1] << 32));
+}
+
+/* g : {0, 1}^n --> {0, 1}^n.  speck64-128 decryption of C[0], using k */
+u64 g(u64 k)
+{
+    if (DEBUG_CHECKS)
+        assert((k & mask) == k);
+    u32 rk[SPECK_ROUNDS];
+    speck_key_schedule_key64(k, rk);
+    u32 x = C[0][1], y = C[0][0];
+    if (check_bits == 0) {
+        for (int i = SPECK_ROUNDS - 1; i >= 0; i--)
+            DR32(x, y, rk[i]);
+        return ((u64) y ^ ((u64) x << 32)) & mask;
+    }
+    u32 x1 = C[1][1], y1 = C[1][0];
+    for (int i = SPECK_ROUNDS - 1; i >= 0; i--) {
+        DR32(x, y, rk[i]);
+        DR32(x1, y1, rk[i]);
+    }
+    return check_image((u64) y ^ ((u64) x << 32), (u64) y1 ^ ((u64) x1 << 32));
+}
+
+bool is_good_pair(u64 k1, u64 k2)
+{
+    u32 mid[2];
+    u32 Ct[2];
+    speck_encrypt_key64(P[1], mid, k1);
+    speck_encrypt_key64(mid, Ct, k2);
+    return (Ct[0] == C[1][0]) && (Ct[1] == C[1][1]);
+}
+
+/* Add the challenge (C0, C1) to the list of challenges. */
+void add_challenge(u64 c0, u64 c1)
+{
+    challenges = realloc(challenges, sizeof(*challenges) * (num_challenges + 1));
+    if (challenges == NULL)
+        err(1, "impossible to allocate the challenges");
+    struct challenge *c = &challenges[num_challenges++];
+    memset(c, 0, sizeof(*c));
+    c->C[0][0] = c0 & 0xffffffff;
+    c->C[0][1] = c0 >> 32;
+    c->C[1][0] = c1 & 0xffffffff;
+    c->C[1][1] = c1 >> 32;
+}
+
+/* Read the challenges of `filename`, one "C0 C1" pair (in hex) per line.
+   Empty lines and lines starting with '#' are ignored. */
+void read_challenges(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+        err(1, "impossible to open %s", filename);
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        u64 c0, c1;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+        if (sscanf(line, "%" SCNx64 " %" SCNx64, &c0, &c1) != 2)
+            errx(1, "invalid challenge in %s: %s", filename, line);
+        add_challenge(c0, c1);
+    }
+    fclose(file);
+}
+
+/* Make g and is_good_pair use the ciphertexts of challenge c. */
+void select_challenge(const struct challenge *c)
+{
+    memcpy(C, c->C, sizeof(C));
+}
+
+/************************** batched MITM kernels ******************************/
+
+/*
+ * Batch versions of f, g and is_good_pair. They evaluate many keys at once
+ * using one 32-bit SIMD lane per key (8 lanes with AVX2, 16 with AVX-512).
+ * The best kernel supported by the CPU is selected at startup, and the scalar
+ * one (which simply calls f, g and is_good_pair) is used as a fallback.
+ */
+struct mitm_kernel {
+    const char *name;
+    int lanes;
+    bool (*supported)();
+    void (*f_batch)(const u64 k[], u64 out[], int count);
+    void (*g_batch)(const u64 k[], u64 out[], int count);
+    void (*is_good_pair_batch)(const u64 k1[], const u64 k2[], bool good[],
+                               int count);
+};
+
+bool scalar_supported()
+{
+    return true;
+}
+
+void f_batch_scalar(const u64 k[], u64 out[], int count)
+{
+    for (int i = 0; i < count; i++)
+        out[i] = f(k[i]);
+}
+
+void g_batch_scalar(const u64 k[], u64 out[], int count)
+{
+    for (int i = 0; i < count; i++)
+        out[i] = g(k[i]);
+}
+
+void is_good_pair_batch_scalar(const u64 k1[], const u64 k2[], bool good[],
+                               int count)
+{
+    for (int i = 0; i < count; i++)
+        good[i] = is_good_pair(k1[i], k2[i]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* The keys of a partial batch of `count` < `lanes` keys, padded with zeros. */
+static inline const u64 *pad_keys(const u64 k[], int count, int lanes,
+                                  u64 padded[])
+{
+    for (int l = 0; l < lanes; l++)
+        padded[l] = (l < count) ? k[l] : 0;
+    return padded;
+}
+
+/* AVX2: 8 keys per vector */
+#define AVX2_LANES  8
+
+#define ROTL32_AVX2(x,r) _mm256_or_si256(_mm256_slli_epi32(x, r), _mm256_srli_epi32(x, 32-(r)))
+#define ROTR32_AVX2(x,r) _mm256_or_si256(_mm256_srli_epi32(x, r), _mm256_slli_epi32(x, 32-(r)))
+
+#define ER32_AVX2(x,y,k) (x=ROTR32_AVX2(x,8), x=_mm256_add_epi32(x,y), x=_mm256_xor_si256(x,k), \
+                          y=ROTL32_AVX2(y,3), y=_mm256_xor_si256(y,x))
+#define DR32_AVX2(x,y,k) (y=_mm256_xor_si256(y,x), y=ROTR32_AVX2(y,3), x=_mm256_xor_si256(x,k), \
+                          x=_mm256_sub_epi32(x,y), x=ROTL32_AVX2(x,8))
+
+bool avx2_supported()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/* Load 8 keys and split them in their low and high 32-bit words. */
+__attribute__((target("avx2")))
+static inline void load_keys_avx2(const u64 k[], __m256i *lo, __m256i *hi)
+{
+    const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    __m256i a = _mm256_permutevar8x32_epi32(
+        _mm256_loadu_si256((const __m256i *) k), split);
+    __m256i b = _mm256_permutevar8x32_epi32(
+        _mm256_loadu_si256((const __m256i *) (k + 4)), split);
+    *lo = _mm256_permute2x128_si256(a, b, 0x20);
+    *hi = _mm256_permute2x128_si256(a, b, 0x31);
+}
+
+/* Store the 8 blocks (y, x) as the images y ^ (x << 32) (see f). */
+__attribute__((target("avx2")))
+static inline void store_blocks_avx2(u64 out[], __m256i y, __m256i x)
+{
+    __m256i m = _mm256_set1_epi64x(image_mask);
+    __m256i a = _mm256_unpacklo_epi32(y, x);
+    __m256i b = _mm256_unpackhi_epi32(y, x);
+    _mm256_storeu_si256((__m256i *) out, _mm256_and_si256(
+        _mm256_permute2x128_si256(a, b, 0x20), m));
+    _mm256_storeu_si256((__m256i *) (out + 4), _mm256_and_si256(
+        _mm256_permute2x128_si256(a, b, 0x31), m));
+}
+
+/* Encrypt (x, y) with the keys (lo, hi, 0, 0), see speck_encrypt_key64. */
+__attribute__((target("avx2")))
+static inline void speck_encrypt_key64_avx2(__m256i *x, __m256i *y,
+                                            __m256i A, __m256i B)
+{
+    __m256i C = _mm256_setzero_si256();
+    __m256i D = _mm256_setzero_si256();
+    for (int i = 0; i < SPECK_ROUNDS;) {
+        ER32_AVX2(*x, *y, A); ER32_AVX2(B, A, _mm256_set1_epi32(i)); i++;
+        ER32_AVX2(*x, *y, A); ER32_AVX2(C, A, _mm256_set1_epi32(i)); i++;
+        ER32_AVX2(*x, *y, A); ER32_AVX2(D, A, _mm256_set1_epi32(i)); i++;
+    }
+}
+
+/* Encrypt (x0, y0) and (x1, y1) with the same keys. */
+__attribute__((target("avx2")))
+static inline void speck_encrypt2_key64_avx2(__m256i *x0, __m256i *y0,
+        __m256i *x1, __m256i *y1, __m256i A, __m256i B)
+{
+    __m256i C = _mm256_setzero_si256();
+    __m256i D = _mm256_setzero_si256();
+    for (int i = 0; i < SPECK_ROUNDS;) {
+        ER32_AVX2(*x0, *y0, A); ER32_AVX2(*x1, *y1, A);
+        ER32_AVX2(B, A, _mm256_set1_epi32(i)); i++;
+        ER32_AVX2(*x0, *y0, A); ER32_AVX2(*x1, *y1, A);
+        ER32_AVX2(C, A, _mm256_set1_epi32(i)); i++;
+        ER32_AVX2(*x0, *y0, A); ER32_AVX2(*x1, *y1, A);
+        ER32_AVX2(D, A, _mm256_set1_epi32(i)); i++;
+    }
+}
+
+__attribute__((target("avx2")))
+void f_batch_avx2(const u64 k[], u64 out[], int count)
+{
+    u64 padded[AVX2_LANES], images[AVX2_LANES];
+
+    for (int b = 0; b < count; b += AVX2_LANES) {
+        int lanes = MIN(AVX2_LANES, count - b);
+        const u64 *keys = (lanes < AVX2_LANES)
+                          ? pad_keys(k + b, lanes, AVX2_LANES, padded) : k + b;
+        __m256i lo, hi;
+        load_keys_avx2(keys, &lo, &hi);
+        __m256i x = _mm256_set1_epi32(P[0][1]);
+        __m256i y = _mm256_set1_epi32(P[0][0]);
+        if (check_bits == 0) {
+            speck_encrypt_key64_avx2(&x, &y, lo, hi);
+        } else {
+            /* n > 32: the check bits only land in the high words */
+            __m256i x1 = _mm256_set1_epi32(P[1][1]);
+            __m256i y1 = _mm256_set1_epi32(P[1][0]);
+            speck_encrypt2_key64_avx2(&x, &y, &x1, &y1, lo, hi);
+            x = _mm256_xor_si256(x, _mm256_slli_epi32(y1, n - 32));
+        }
+        if (lanes == AVX2_LANES) {
+            store_blocks_avx2(out + b, y, x);
+        } else {
+            store_blocks_avx2(images, y, x);
+            memcpy(out + b, images, sizeof(u64) * lanes);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void g_batch_avx2(const u64 k[], u64 out[], int count)
+{
+    u64 padded[AVX2_LANES], images[AVX2_LANES];
+    __m256i rk[SPECK_ROUNDS];
+    __m256i cx = _mm256_set1_epi32(C[0][1]), cy = _mm256_set1_epi32(C[0][0]);
+    __m256i cx1 = _mm256_set1_epi32(C[1][1]), cy1 = _mm256_set1_epi32(C[1][0]);
+
+    for (int b = 0; b < count; b += AVX2_LANES) {
+        int lanes = MIN(AVX2_LANES, count - b);
+        const u64 *keys = (lanes < AVX2_LANES)
+                          ? pad_keys(k + b, lanes, AVX2_LANES, padded) : k + b;
+        __m256i A, B;
+        load_keys_avx2(keys, &A, &B);
+        __m256i C = _mm256_setzero_si256();
+        __m256i D = _mm256_setzero_si256();
+        for (int i = 0; i < SPECK_ROUNDS;) {
+            rk[i] = A; ER32_AVX2(B, A, _mm256_set1_epi32(i)); i++;
+            rk[i] = A; ER32_AVX2(C, A, _mm256_set1_epi32(i)); i++;
+            rk[i] = A; ER32_AVX2(D, A, _mm256_set1_epi32(i)); i++;
+        }
+        __m256i x = cx, y = cy;
+        if (check_bits == 0) {
+            for (int i = SPECK_ROUNDS - 1; i >= 0; i--)
+                DR32_AVX2(x, y, rk[i]);
+        } else {
+            __m256i x1 = cx1, y1 = cy1;
+            for (int i = SPECK_ROUNDS - 1; i >= 0; i--) {
+                DR32_AVX2(x, y, rk[i]);
+                DR32_AVX2(x1, y1, rk[i]);
+            }
+            x = _mm256_xor_si256(x, _mm256_slli_epi32(y1, n - 32));
+        }
+        if (lanes == AVX2_LANES) {
+            store_blocks_avx2(out + b, y, x);
+        } else {
+            store_blocks_avx2(images, y, x);
+            memcpy(out + b, images, sizeof(u64) * lanes);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void is_good_pair_batch_avx2(const u64 k1[], const u64 k2[], bool good[],
+                             int count)
+{
+    u64 padded1[AVX2_LANES], padded2[AVX2_LANES];
+
+    for (int b = 0; b < count; b += AVX2_LANES) {
+        int lanes = MIN(AVX2_LANES, count - b);
+        const u64 *keys1 = k1 + b, *keys2 = k2 + b;
+        if (lanes < AVX2_LANES) {
+            keys1 = pad_keys(keys1, lanes, AVX2_LANES, padded1);
+            keys2 = pad_keys(keys2, lanes, AVX2_LANES, padded2);
+        }
+        __m256i lo, hi;
+        __m256i x = _mm256_set1_epi32(P[1][1]);
+        __m256i y = _mm256_set1_epi32(P[1][0]);
+        load_keys_avx2(keys1, &lo, &hi);
+        speck_encrypt_key64_avx2(&x, &y, lo, hi);
+        load_keys_avx2(keys2, &lo, &hi);
+        speck_encrypt_key64_avx2(&x, &y, lo, hi);
+        __m256i eq = _mm256_and_si256(
+            _mm256_cmpeq_epi32(y, _mm256_set1_epi32(C[1][0])),
+            _mm256_cmpeq_epi32(x, _mm256_set1_epi32(C[1][1])));
+        int matches = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        for (int l = 0; l < lanes; l++)
+            good[b + l] = (matches >> l) & 1;
+    }
+}
+
+/* AVX-512: 16 keys per vector, with native rotations */
+#define AVX512_LANES  16
+
+#define ER32_AVX512(x,y,k) (x=_mm512_ror_epi32(x,8), x=_mm512_add_epi32(x,y), x=_mm512_xor_si512(x,k), \
+                            y=_mm512_rol_epi32(y,3), y=_mm512_xor_si512(y,x))
+#define DR32_AVX512(x,y,k) (y=_mm512_xor_si512(y,x), y=_mm512_ror_epi32(y,3), x=_mm512_xor_si512(x,k), \
+                            x=_mm512_sub_epi32(x,y), x=_mm512_rol_epi32(x,8))
+
+bool avx512_supported()
+{
+    return __builtin_cpu_supports("avx512f");
+}
+
+/* Load 16 keys and split them in their low and high 32-bit words. */
+__attribute__((target("avx512f")))
+static inline void load_keys_avx512(const u64 k[], __m512i *lo, __m512i *hi)
+{
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18,
+                                           20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19,
+                                          21, 23, 25, 27, 29, 31);
+    __m512i a = _mm512_loadu_si512(k);
+    __m512i b = _mm512_loadu_si512(k + 8);
+    *lo = _mm512_permutex2var_epi32(a, even, b);
+    *hi = _mm512_permutex2var_epi32(a, odd, b);
+}
+
+/* Store the 16 blocks (y, x) as the images y ^ (x << 32) (see f). */
+__attribute__((target("avx512f")))
+static inline void store_blocks_avx512(u64 out[], __m512i y, __m512i x)
+{
+    const __m512i first = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20,
+                                            5, 21, 6, 22, 7, 23);
+    const __m512i second = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12,
+                                             28, 13, 29, 14, 30, 15, 31);
+    __m512i m = _mm512_set1_epi64(image_mask);
+    _mm512_storeu_si512(out, _mm512_and_si512(
+        _mm512_permutex2var_epi32(y, first, x), m));
+    _mm512_storeu_si512(out + 8, _mm512_and_si512(
+        _mm512_permutex2var_epi32(y, second, x), m));
+}
+
+/* Encrypt (x, y) with the keys (lo, hi, 0, 0), see speck_encrypt_key64. */
+__attribute__((target("avx512f")))
+static inline void speck_encrypt_key64_avx512(__m512i *x, __m512i *y,
+                                              __m512i A, __m512i B)
+{
+    __m512i C = _mm512_setzero_si512();
+    __m512i D = _mm512_setzero_si512();
+    for (int i = 0; i < SPECK_ROUNDS;) {
+        ER32_AVX512(*x, *y, A); ER32_AVX512(B, A, _mm512_set1_epi32(i)); i++;
+        ER32_AVX512(*x, *y, A); ER32_AVX512(C, A, _mm512_set1_epi32(i)); i++;
+        ER32_AVX512(*x, *y, A); ER32_AVX512(D, A, _mm512_set1_epi32(i)); i++;
+    }
+}
+
+/* Encrypt (x0, y0) and (x1, y1) with the same keys. */
+__attribute__((target("avx512f")))
+static inline void speck_encrypt2_key64_avx512(__m512i *x0, __m512i *y0,
+        __m512i *x1, __m512i *y1, __m512i A, __m512i B)
+{
+    __m512i C = _mm512_setzero_si512();
+    __m512i D = _mm512_setzero_si512();
+    for (int i = 0; i < SPECK_ROUNDS;) {
+        ER32_AVX512(*x0, *y0, A); ER32_AVX512(*x1, *y1, A);
+        ER32_AVX512(B, A, _mm512_set1_epi32(i)); i++;
+        ER32_AVX512(*x0, *y0, A); ER32_AVX512(*x1, *y1, A);
+        ER32_AVX512(C, A, _mm512_set1_epi32(i)); i++;
+        ER32_AVX512(*x0, *y0, A); ER32_AVX512(*x1, *y1, A);
+        ER32_AVX512(D, A, _mm512_set1_epi32(i)); i++;
+    }
+}
+
+__attribute__((target("avx512f")))
+void f_batch_avx512(const u64 k[], u64 out[], int count)
+{
+    u64 padded[AVX512_LANES], images[AVX512_LANES];
+
+    for (int b = 0; b < count; b += AVX512_LANES) {
+        int lanes = MIN(AVX512_LANES, count - b);
+        const u64 *keys = (lanes < AVX512_LANES)
+                          ? pad_keys(k + b, lanes, AVX512_LANES, padded) : k + b;
+        __m512i lo, hi;
+        load_keys_avx512(keys, &lo, &hi);
+        __m512i x = _mm512_set1_epi32(P[0][1]);
+        __m512i y = _mm512_set1_epi32(P[0][0]);
+        if (check_bits == 0) {
+            speck_encrypt_key64_avx512(&x, &y, lo, hi);
+        } else {
+            /* n > 32: the check bits only land in the high words */
+            __m512i x1 = _mm512_set1_epi32(P[1][1]);
+            __m512i y1 = _mm512_set1_epi32(P[1][0]);
+            speck_encrypt2_key64_avx512(&x, &y, &x1, &y1, lo, hi);
+            x = _mm512_xor_si512(x, _mm512_slli_epi32(y1, n - 32));
+        }
+        if (lanes == AVX512_LANES) {
+            store_blocks_avx512(out + b, y, x);
+        } else {
+            store_blocks_avx512(images, y, x);
+            memcpy(out + b, images, sizeof(u64) * lanes);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void g_batch_avx512(const u64 k[], u64 out[], int count)
+{
+    u64 padded[AVX512_LANES], images[AVX512_LANES];
+    __m512i rk[SPECK_ROUNDS];
+    __m512i cx = _mm512_set1_epi32(C[0][1]), cy = _mm512_set1_epi32(C[0][0]);
+    __m512i cx1 = _mm512_set1_epi32(C[1][1]), cy1 = _mm512_set1_epi32(C[1][0]);
+
+    for (int b = 0; b < count; b += AVX512_LANES) {
+        int lanes = MIN(AVX512_LANES, count - b);
+        const u64 *keys = (lanes < AVX512_LANES)
+                          ? pad_keys(k + b, lanes, AVX512_LANES, padded) : k + b;
+        __m512i A, B;
+        load_keys_avx512(keys, &A, &B);
+        __m512i C = _mm512_setzero_si512();
+        __m512i D = _mm512_setzero_si512();
+        for (int i = 0; i < SPECK_ROUNDS;) {
+            rk[i] = A; ER32_AVX512(B, A, _mm512_set1_epi32(i)); i++;
+            rk[i] = A; ER32_AVX512(C, A, _mm512_set1_epi32(i)); i++;
+            rk[i] = A; ER32_AVX512(D, A, _mm512_set1_epi32(i)); i++;
+        }
+        __m512i x = cx, y = cy;
+        if (check_bits == 0) {
+            for (int i = SPECK_ROUNDS - 1; i >= 0; i--)
+                DR32_AVX512(x, y, rk[i]);
+        } else {
+            __m512i x1 = cx1, y1 = cy1;
+            for (int i = SPECK_ROUNDS - 1; i >= 0; i--) {
+                DR32_AVX512(x, y, rk[i]);
+                DR32_AVX512(x1, y1, rk[i]);
+            }
+            x = _mm512_xor_si512(x, _mm512_slli_epi32(y1, n - 32));
+        }
+        if (lanes == AVX512_LANES) {
+            store_blocks_avx512(out + b, y, x);
+        } else {
+            store_blocks_avx512(images, y, x);
+            memcpy(out + b, images, sizeof(u64) * lanes);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void is_good_pair_batch_avx512(const u64 k1[], const u64 k2[], bool good[],
+                               int count)
+{
+    u64 padded1[AVX512_LANES], padded2[AVX512_LANES];
+
+    for (int b = 0; b < count; b += AVX512_LANES) {
+        int lanes = MIN(AVX512_LANES, count - b);
+        const u64 *keys1 = k1 + b, *keys2 = k2 + b;
+        if (lanes < AVX512_LANES) {
+            keys1 = pad_keys(keys1, lanes, AVX512_LANES, padded1);
+            keys2 = pad_keys(keys2, lanes, AVX512_LANES, padded2);
+        }
+        __m512i lo, hi;
+        __m512i x = _mm512_set1_epi32(P[1][1]);
+        __m512i y = _mm512_set1_epi32(P[1][0]);
+        load_keys_avx512(keys1, &lo, &hi);
+        speck_encrypt_key64_avx512(&x, &y, lo, hi);
+        load_keys_avx512(keys2, &lo, &hi);
+        speck_encrypt_key64_avx512(&x, &y, lo, hi);
+        __mmask16 matches =
+            _mm512_cmpeq_epi32_mask(y, _mm512_set1_epi32(C[1][0]))
+            & _mm512_cmpeq_epi32_mask(x, _mm512_set1_epi32(C[1][1]));
+        for (int l = 0; l < lanes; l++)
+            good[b + l] = (matches >> l) & 1;
+    }
+}
+#endif
+
+/* available kernels, from the fastest to the slowest */
+struct mitm_kernel kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", AVX512_LANES, avx512_supported, f_batch_avx512, g_batch_avx512,
+     is_good_pair_batch_avx512},
+    {"avx2", AVX2_LANES, avx2_supported, f_batch_avx2, g_batch_avx2,
+     is_good_pair_batch_avx2},
+#endif
+    {"scalar", 1, scalar_supported, f_batch_scalar, g_batch_scalar,
+     is_good_pair_batch_scalar},
+};
+
+struct mitm_kernel *kernel = NULL;    /* selected kernel */
+
+/* Select the kernel called `name`, or the fastest supported one if NULL. */
+void select_kernel(const char *name)
+{
+    int num_kernels = sizeof(kernels) / sizeof(*kernels);
+    if (name == NULL) {
+        /* the scalar kernel, the last one, is always supported */
+        int i = 0;
+        while (i < num_kernels - 1 && !kernels[i].supported())
+            i++;
+        kernel = &kernels[i];
+        return;
+    }
+    for (int i = 0; i < num_kernels; i++) {
+        if (strcmp(name, kernels[i].name) != 0)
+            continue;
+        if (!kernels[i].supported())
+            errx(1, "kernel %s is not supported by this CPU", name);
+        kernel = &kernels[i];
+        return;
+    }
+    errx(1, "unknown kernel %s", name);
+}
+
+/***************************** MPI functions ***********************************/
+
+/* Memory (in bytes) used by the buffers of a process with `slots` slots in
+   its dictionary: every set has both send and receive buffers (an inbox of
+   the same size replaces the latter with the one-sided exchange). With the
+   two-level exchange, the leader of a node also packs the send and receive
+   buffers of its processes, i.e. two more buffers per process. */
+u64 buffers_memory(u64 slots)
+{
+    u64 buffer = GET_BUFFER_SIZE(slots) * element_words * num_processes *
+                 sizeof(u64);
+    if (exchange_mode == HIER_EXCHANGE)
+        return buffer * 2 * (NUM_BUFFER_SETS + 1);
+    return buffer * 2 * NUM_BUFFER_SETS;
+}
+
+/*
+ * Two-level (topology-aware) exchange, with --exchange hier. The processes of
+ * a node (a shared-memory communicator, or groups of --ranks-per-node ranks
+ * to emulate nodes) keep their buffers in a shared window. Once they have all
+ * filled a set, the node leader packs the elements of the whole node for each
+ * other node in a single message, exchanges them with the other leaders, and
+ * writes the elements it receives directly into the receive buffers of its
+ * processes. The inter-node messages drop from P^2 to nodes^2 and get larger.
+ * Each step is nonblocking and progressed like the flat exchange.
+ */
+/* steps of a two-level exchange */
+enum hier_step { HIER_GATHER, HIER_SIZES, HIER_ELEMENTS, HIER_SCATTER,
+                 HIER_DONE };
+
+int ranks_per_node = 0;         /* emulated node size (0: real nodes) */
+MPI_Comm node_comm;             /* processes of our node */
+MPI_Comm leader_comm = MPI_COMM_NULL;   /* node leaders (rank 0 of nodes) */
+int node_rank, node_size;       /* rank and size in node_comm */
+int num_nodes;
+int *node_members;              /* ranks of each node, node after node */
+int *node_displs;               /* first member of each node */
+
+/* sets of all the processes of the node, in the shared window */
+MPI_Win shared_window;
+struct buffer_set *node_sets;   /* set s of local process l at l * SETS + s */
+
+/* messages between leaders */
+u64 *pack_send, *pack_recv;
+int *pack_send_sizes, *pack_recv_sizes, *pack_send_displs, *pack_recv_displs;
+
+/* Find the nodes and their leaders. */
+void setup_topology()
+{
+    MPI_Comm shared_comm;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &shared_comm);
+    if (ranks_per_node > 0) {
+        int shared_rank;
+        MPI_Comm_rank(shared_comm, &shared_rank);
+        MPI_Comm_split(shared_comm, shared_rank / ranks_per_node, rank,
+                       &node_comm);
+        MPI_Comm_free(&shared_comm);
+    } else {
+        node_comm = shared_comm;
+    }
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, (node_rank == 0) ? 0 : MPI_UNDEFINED, rank,
+                   &leader_comm);
+
+    /* the node of a process is the rank of its leader among the leaders */
+    int node = 0;
+    if (node_rank == 0) {
+        MPI_Comm_rank(leader_comm, &node);
+        MPI_Comm_size(leader_comm, &num_nodes);
+    }
+    MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
+    MPI_Bcast(&num_nodes, 1, MPI_INT, 0, node_comm);
+
+    int local[2] = {node, node_rank};
+    int *all = malloc(sizeof(int) * 2 * num_processes);
+    node_members = malloc(sizeof(int) * num_processes);
+    node_displs = calloc(num_nodes + 1, sizeof(int));
+    if (all == NULL || node_members == NULL || node_displs == NULL)
+        err(1, "impossible to allocate the topology");
+    MPI_Allgather(local, 2, MPI_INT, all, 2, MPI_INT, MPI_COMM_WORLD);
+
+    for (int r = 0; r < num_processes; r++)
+        node_displs[all[2 * r] + 1] += 1;
+    for (int b = 0; b < num_nodes; b++)
+        node_displs[b + 1] += node_displs[b];
+    for (int r = 0; r < num_processes; r++)
+        node_members[node_displs[all[2 * r]] + all[2 * r + 1]] = r;
+    free(all);
+}
+
+/* Number of messages between nodes in an exchange of all processes. */
+u64 inter_node_messages()
+{
+    if (exchange_mode == HIER_EXCHANGE)
+        return (u64) num_nodes * (num_nodes - 1);
+    u64 messages = 0;
+    for (int b = 0; b < num_nodes; b++) {
+        u64 size = node_displs[b + 1] - node_displs[b];
+        messages += size * (num_processes - size);
+    }
+    return messages;
+}
+
+/* Split the `slots` slots of the hash table between the processes, in whole
+   buckets. They get the same number of buckets, unless their --weight differ:
+   then their shards are proportional to their weights. */
+void setup_shards(u64 slots)
+{
+    if (weight_from_memory)
+        shard_weight = (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE)
+                       / node_size;
+
+    double *weights = malloc(sizeof(double) * num_processes);
+    shard_starts = malloc(sizeof(u64) * (num_processes + 1));
+    if (weights == NULL || shard_starts == NULL)
+        err(1, "impossible to allocate the shards");
+    MPI_Allgather(&shard_weight, 1, MPI_DOUBLE, weights, 1, MPI_DOUBLE,
+                  MPI_COMM_WORLD);
+
+    double total = 0;
+    for (int r = 0; r < num_processes; r++) {
+        total += weights[r];
+        weighted_shards |= weights[r] != weights[0];
+    }
+
+    u64 buckets = (slots + BUCKET_SLOTS - 1) / BUCKET_SLOTS;
+    if (!weighted_shards)
+        buckets = (buckets + num_processes - 1) / num_processes * num_processes;
+    double cumulated = 0;
+    for (int r = 0; r < num_processes; r++) {
+        shard_starts[r] = (u64) round(buckets * cumulated / total) * BUCKET_SLOTS;
+        cumulated += weights[r];
+    }
+    shard_starts[num_processes] = buckets * BUCKET_SLOTS;
+    free(weights);
+
+    shard_start = shard_starts[rank];
+    dict_size = shard_starts[rank + 1] - shard_start;
+    dict_size_global = shard_starts[num_processes];
+    if (dict_size == 0)
+        errx(1, "the weight of process %d is too small for a shard", rank);
+}
+
+/* Process owning the slot of a key whose hash is `hash`. The shards of the
+   same size split the table evenly, so the owner is (hash * num_processes)
+   / 2**64, the slot divided by dict_size (see hash_slot). */
+static inline int shard_owner(u64 hash)
+{
+    if (!weighted_shards)
+        return ((unsigned __int128) hash * num_processes) >> 64;
+
+    /* the last shard starting at or before the slot */
+    u64 h = hash_slot(hash);
+    int lo = 0, hi = num_processes - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (shard_starts[mid] <= h)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Number of keys among 0, ..., total - 1 assigned to this process by the
+   cyclic distribution, i.e. those equal to rank modulo num_processes. */
+u64 cyclic_share(u64 total)
+{
+    return (total + num_processes - 1 - rank) / num_processes;
+}
+
+/* Allocate the buffer sets of the node in a shared window, and the messages
+   of the leader. */
+void setup_hier_buffers()
+{
+    u64 elements = buffer_size * element_words * num_processes;
+    u64 set_words = 2 * elements + 2 * num_processes;
+    u64 *base;
+
+    MPI_Win_allocate_shared(sizeof(u64) * set_words * NUM_BUFFER_SETS,
+                            sizeof(u64), MPI_INFO_NULL, node_comm, &base,
+                            &shared_window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_window);
+
+    node_sets = malloc(sizeof(*node_sets) * node_size * NUM_BUFFER_SETS);
+    if (node_sets == NULL)
+        err(1, "impossible to allocate the buffers");
+    for (int l = 0; l < node_size; l++) {
+        MPI_Aint size;
+        int disp_unit;
+        MPI_Win_shared_query(shared_window, l, &size, &disp_unit, &base);
+        for (int s = 0; s < NUM_BUFFER_SETS; s++) {
+            struct buffer_set *set = &node_sets[l * NUM_BUFFER_SETS + s];
+            u64 *words = base + set_words * s;
+            set->send = words;
+            set->recv = words + elements;
+            set->send_counts = words + 2 * elements;
+            set->recv_counts = words + 2 * elements + num_processes;
+        }
+    }
+    for (int s = 0; s < NUM_BUFFER_SETS; s++) {
+        struct buffer_set *set = &buffer_sets[s];
+        struct buffer_set *shared = &node_sets[node_rank * NUM_BUFFER_SETS + s];
+        set->send = shared->send;
+        set->recv = shared->recv;
+        set->send_counts = shared->send_counts;
+        set->recv_counts = shared->recv_counts;
+    }
+
+    if (node_rank != 0)
+        return;
+    /* a leader sends (and receives) the counts and elements of the node */
+    u64 pack_words = (u64) node_size * (elements + num_processes);
+    if (pack_words > INT_MAX)
+        errx(1, "the node buffers are too large, use a higher compression level");
+    pack_send = malloc(sizeof(u64) * pack_words);
+    pack_recv = malloc(sizeof(u64) * pack_words);
+    pack_send_sizes = malloc(sizeof(int) * num_nodes);
+    pack_recv_sizes = malloc(sizeof(int) * num_nodes);
+    pack_send_displs = malloc(sizeof(int) * num_nodes);
+    pack_recv_displs = malloc(sizeof(int) * num_nodes);
+    if (pack_send == NULL || pack_recv == NULL || pack_send_sizes == NULL
+        || pack_recv_sizes == NULL || pack_send_displs == NULL
+        || pack_recv_displs == NULL)
+        err(1, "impossible to allocate the node buffers");
+}
+
+/* Allocate memory space for the buffers and the buffer counts. */
+void setup_buffers()
+{
+    /* NOTE: The buffer_size describes the number of elements for ONE process.
+       Therefore, the total number of elements that a process may hold is
+       buffer_size * num_processes. Each thread stages its elements in its own
+       slice of thread_buffer_size elements of every buffer. */
+    thread_buffer_size = MAX(GET_BUFFER_SIZE(dict_size_global / num_processes)
+                             / num_threads, 1);
+    buffer_size = thread_buffer_size * num_threads;
+
+    if (exchange_mode == HIER_EXCHANGE)
+        setup_hier_buffers();
+    for (int s = 0; s < NUM_BUFFER_SETS; s++) {
+        struct buffer_set *set = &buffer_sets[s];
+        if (exchange_mode != HIER_EXCHANGE) {
+            set->send = alloc_table(sizeof(u64) * buffer_size * element_words
+                                    * num_processes, NULL);
+            set->send_counts = malloc(sizeof(u64) * num_processes);
+            set->recv_counts = malloc(sizeof(u64) * num_processes);
+        }
+        /* with the one-sided exchange, the elements arrive in the inbox */
+        if (exchange_mode == FLAT_EXCHANGE)
+            set->recv = alloc_table(sizeof(u64) * buffer_size * element_words
+                                    * num_processes, NULL);
+        set->send_sizes = malloc(sizeof(int) * num_processes);
+        set->recv_sizes = malloc(sizeof(int) * num_processes);
+        set->cursors = malloc(sizeof(u64) * num_threads);
+        if (set->send == NULL ||
+            (set->recv == NULL && exchange_mode != RMA_EXCHANGE) ||
+            set->send_counts == NULL || set->recv_counts == NULL ||
+            set->send_sizes == NULL || set->recv_sizes == NULL ||
+            set->cursors == NULL)
+            err(1, "impossible to allocate the buffers");
+        set->requests[0] = set->requests[1] = MPI_REQUEST_NULL;
+        if (exchange_mode == FLAT_EXCHANGE)
+            first_touch(set->recv, sizeof(u64) * buffer_size * element_words
+                                   * num_processes);
+    }
+    buffers = &buffer_sets[0];
+
+    /* each thread first touches its own slices of the send buffers */
+    if (exchange_mode != HIER_EXCHANGE) {
+        #pragma omp parallel num_threads(num_threads)
+        {
+            u64 slice = thread_buffer_size * element_words;
+            u64 offset = slice * omp_get_thread_num();
+            for (int s = 0; s < NUM_BUFFER_SETS; s++)
+                for (int i = 0; i < num_processes; i++)
+                    memset(&buffer_sets[s].send[buffer_size * element_words * i
+                                                + offset], 0, sizeof(u64) * slice);
+        }
+    }
+
+    /* the buffers are exchanged with all-to-allv, whose offsets are ints */
+    if (buffer_size * num_processes > INT_MAX)
+        errx(1, "the buffers are too large, use a higher compression level");
+    buffers_displs = malloc(sizeof(int) * num_processes);
+    if (buffers_displs == NULL)
+        err(1, "impossible to allocate the buffers");
+    for (int i = 0; i < num_processes; i++) {
+        buffers_displs[i] = buffer_size * i;
+    }
+    MPI_Type_contiguous(element_words, MPI_UINT64_T, &element_type);
+    MPI_Type_commit(&element_type);
+
+    threads_counts = malloc(sizeof(*threads_counts) * num_threads * num_processes);
+    if (threads_counts == NULL)
+        err(1, "impossible to allocate the buffers");
+    for (int i = 0; i < num_threads * num_processes; i++) {
+        threads_counts[i] = 0;
+    }
+}
+
+/* An element of the buffers takes a single word, the key in the high n bits
+   and the value in the low n bits, when 2n <= 64. It takes two otherwise: the
+   hash of the key, so that its owner only computes it once, and the value.
+   The key is then recovered from its hash, for the joins that need it. */
+static inline void set_element(u64 *e, u64 hash, u64 key, u64 value)
+{
+    if (element_words == 1) {
+        e[0] = (key << n) | value;
+    } else {
+        e[0] = hash;
+        e[1] = value;
+    }
+}
+
+static inline u64 element_hash(const u64 *e)
+{
+    return (element_words == 1) ? murmur64(e[0] >> n) : e[0];
+}
+
+static inline u64 element_key(const u64 *e)
+{
+    return (element_words == 1) ? e[0] >> n : murmur64_inverse(e[0]);
+}
+
+static inline u64 element_value(const u64 *e)
+{
+    return (element_words == 1) ? e[0] & mask : e[1];
+}
+
+/* Add an element to the slice of `thread` in the buffer. Returns 1 if the
+   element's buffer slice is full. */
+int add_to_buffer(int thread, u64 key, u64 val)
+{
+    u64 hash = murmur64(key);
+    int h_rank = shard_owner(hash);
+    u64 *count = &threads_counts[thread * num_processes + h_rank];
+    u64 slot = buffer_size * h_rank + thread_buffer_size * thread + *count;
+
+    set_element(buffers->send + element_words * slot, hash, key, val);
+    *count += 1;
+
+    return (*count >= buffer_fill)? 1 : 0;
+}
+
+/* Gather the slices of all threads at the beginning of each buffer. It must
+   be called by all threads of the process. */
+void compact_buffers()
+{
+    #pragma omp for schedule(static)
+    for (int i = 0; i < num_processes; i++) {
+        u64 *buffer = buffers->send + buffer_size * element_words * i;
+        u64 count = 0;
+        for (int t = 0; t < num_threads; t++) {
+            u64 *slice = buffer + thread_buffer_size * element_words * t;
+            u64 *thread_count = &threads_counts[t * num_processes + i];
+            if (t > 0)
+                memmove(buffer + element_words * count, slice,
+                        sizeof(u64) * element_words * *thread_count);
+            count += *thread_count;
+            *thread_count = 0;
+        }
+        buffers->send_counts[i] = count;
+    }
+}
+
+/* Update the buffer occupancy counters. */
+void update_buffer_occupancy_statistics()
+{
+    u64 num_elements = 0;
+    for (int i = 0; i < num_processes; i++) {
+        num_elements += buffers->send_counts[i];
+    }
+    u64 capacity = buffer_fill * num_threads * num_processes;
+    num_exchanges += 1;
+    elements_capacity += capacity;
+    cum_buffer_occupancy += (double) num_elements / capacity;
+}
+
+/* Start exchanging the buffer sizes of the set being filled, then switch to
+   the next set. The `flags` are sent along the counts: DONE_FLAG tells the
+   other processes that this is our last exchange with elements, FOUND_FLAG
+   that we found a solution, and CHECKPOINT_FLAG (from the root) that they
+   must write a checkpoint once the exchange is processed. The buffers
+   themselves are sent once the sizes are known, so that only their occupied
+   part goes through the network. */
+void exchange_buffers(u64 flags)
+{
+    struct buffer_set *set = buffers;
+
+    update_buffer_occupancy_statistics();
+    for (int i = 0; i < num_processes; i++) {
+        set->send_sizes[i] = set->send_counts[i];
+        set->send_counts[i] |= flags;
+    }
+
+    if (exchange_mode == HIER_EXCHANGE) {
+        /* the leader takes over once all the node has filled the set */
+        for (int i = 0; i < num_processes; i++)
+            elements_sent += set->send_sizes[i];
+        MPI_Win_sync(shared_window);
+        MPI_Ibarrier(node_comm, &set->requests[0]);
+        set->step = HIER_GATHER;
+    } else {
+        MPI_Ialltoall(set->send_counts, BUFFER_COUNT_MSG_SIZE, MPI_UINT64_T,
+                      set->recv_counts, BUFFER_COUNT_MSG_SIZE, MPI_UINT64_T,
+                      MPI_COMM_WORLD, &set->requests[0]);
+        set->elements_posted = false;
+    }
+
+    buffers = &buffer_sets[(set - buffer_sets + 1) % NUM_BUFFER_SETS];
+}
+
+/* Read (and clear) the flags sent along the received counts of `set`. */
+void read_exchange_flags(struct buffer_set *set)
+{
+    set->all_done = true;
+    set->any_found = false;
+    set->checkpoint = (set->recv_counts[ROOT_RANK] & CHECKPOINT_FLAG) != 0;
+    for (int i = 0; i < num_processes; i++) {
+        set->all_done &= (set->recv_counts[i] & DONE_FLAG) != 0;
+        set->any_found |= (set->recv_counts[i] & FOUND_FLAG) != 0;
+        set->recv_counts[i] &= ~EXCHANGE_FLAGS;
+    }
+}
+
+/* Send the occupied part of the buffers of `set`, whose sizes are known. */
+void exchange_buffer_elements(struct buffer_set *set)
+{
+    read_exchange_flags(set);
+    for (int i = 0; i < num_processes; i++) {
+        set->recv_sizes[i] = set->recv_counts[i];
+        elements_sent += set->send_sizes[i];
+    }
+
+    MPI_Ialltoallv(set->send, set->send_sizes, buffers_displs, element_type,
+                   set->recv, set->recv_sizes, buffers_displs, element_type,
+                   MPI_COMM_WORLD, &set->requests[1]);
+    set->elements_posted = true;
+}
+
+/* Pack the counts, then the elements, of all the processes of the node for
+   each node, in pack_send. */
+void pack_node_elements(int s)
+{
+    u64 *out = pack_send;
+    for (int b = 0; b < num_nodes; b++) {
+        u64 *start = out;
+        for (int l = 0; l < node_size; l++) {
+            struct buffer_set *set = &node_sets[l * NUM_BUFFER_SETS + s];
+            for (int m = node_displs[b]; m < node_displs[b + 1]; m++)
+                *out++ = set->send_counts[node_members[m]];
+        }
+        for (int l = 0; l < node_size; l++) {
+            struct buffer_set *set = &node_sets[l * NUM_BUFFER_SETS + s];
+            for (int m = node_displs[b]; m < node_displs[b + 1]; m++) {
+                int r = node_members[m];
+                u64 count = set->send_counts[r] & ~EXCHANGE_FLAGS;
+                memcpy(out, set->send + buffer_size * element_words * r,
+                       sizeof(u64) * element_words * count);
+                out += element_words * count;
+            }
+        }
+        pack_send_displs[b] = start - pack_send;
+        pack_send_sizes[b] = out - start;
+    }
+}
+
+/* Write the counts and elements received from each node in the receive
+   buffers of the processes of the node. */
+void unpack_node_elements(int s)
+{
+    for (int a = 0; a < num_nodes; a++) {
+        int sources = node_displs[a + 1] - node_displs[a];
+        u64 *counts = pack_recv + pack_recv_displs[a];
+        u64 *in = counts + sources * node_size;
+        for (int i = 0; i < sources; i++) {
+            int r = node_members[node_displs[a] + i];
+            for (int l = 0; l < node_size; l++) {
+                struct buffer_set *set = &node_sets[l * NUM_BUFFER_SETS + s];
+                u64 count = counts[i * node_size + l];
+                set->recv_counts[r] = count;
+                count &= ~EXCHANGE_FLAGS;
+                memcpy(set->recv + buffer_size * element_words * r, in,
+                       sizeof(u64) * element_words * count);
+                in += element_words * count;
+            }
+        }
+    }
+}
+
+/* Advance the two-level exchange of `set` as far as possible, blocking if
+   `wait` is set. Returns true once it is complete. */
+bool progress_hier_exchange(struct buffer_set *set, bool wait)
+{
+    int s = set - buffer_sets;
+
+    while (set->step != HIER_DONE) {
+        int flag = 1;
+        if (wait)
+            MPI_Wait(&set->requests[0], MPI_STATUS_IGNORE);
+        else
+            MPI_Test(&set->requests[0], &flag, MPI_STATUS_IGNORE);
+        if (!flag)
+            return false;
+        MPI_Win_sync(shared_window);
+
+        switch (set->step) {
+        case HIER_GATHER:
+            if (node_rank != 0) {
+                /* wait for the leader to fill our receive buffers */
+                MPI_Ibarrier(node_comm, &set->requests[0]);
+                set->step = HIER_SCATTER;
+                break;
+            }
+            pack_node_elements(s);
+            MPI_Ialltoall(pack_send_sizes, 1, MPI_INT, pack_recv_sizes, 1,
+                          MPI_INT, leader_comm, &set->requests[0]);
+            set->step = HIER_SIZES;
+            break;
+        case HIER_SIZES:
+            for (int b = 0, displ = 0; b < num_nodes; b++) {
+                pack_recv_displs[b] = displ;
+                displ += pack_recv_sizes[b];
+            }
+            MPI_Ialltoallv(pack_send, pack_send_sizes, pack_send_displs,
+                           MPI_UINT64_T, pack_recv, pack_recv_sizes,
+                           pack_recv_displs, MPI_UINT64_T, leader_comm,
+                           &set->requests[0]);
+            set->step = HIER_ELEMENTS;
+            break;
+        case HIER_ELEMENTS:
+            unpack_node_elements(s);
+            MPI_Win_sync(shared_window);
+            MPI_Ibarrier(node_comm, &set->requests[0]);
+            set->step = HIER_SCATTER;
+            break;
+        case HIER_SCATTER:
+            read_exchange_flags(set);
+            set->step = HIER_DONE;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+/* Give MPI a chance to progress the exchange of `set` in the background. */
+void progress_exchange(struct buffer_set *set)
+{
+    int flag;
+
+    if (exchange_mode == HIER_EXCHANGE) {
+        progress_hier_exchange(set, false);
+        return;
+    }
+    if (!set->elements_posted) {
+        MPI_Test(&set->requests[0], &flag, MPI_STATUS_IGNORE);
+        if (!flag)
+            return;
+        exchange_buffer_elements(set);
+    }
+    MPI_Test(&set->requests[1], &flag, MPI_STATUS_IGNORE);
+}
+
+/* Wait for the exchange of `set` to complete. Returns true if all processes
+   were done in this exchange. */
+bool wait_exchange(struct buffer_set *set)
+{
+    if (exchange_mode == HIER_EXCHANGE) {
+        progress_hier_exchange(set, true);
+        return set->all_done;
+    }
+    if (!set->elements_posted) {
+        MPI_Wait(&set->requests[0], MPI_STATUS_IGNORE);
+        exchange_buffer_elements(set);
+    }
+    MPI_Wait(&set->requests[1], MPI_STATUS_IGNORE);
+    return set->all_done;
+}
+
+/* Insert the `count` (key, value) elements of `elements` into the dict. They
+   are split between the threads that call it, without a final barrier. */
+void insert_elements(const u64 *elements, u64 count)
+{
+    u64 hashes[PREFETCH_WINDOW];
+
+    #pragma omp for schedule(static) nowait
+    for (u64 w = 0; w < count; w += PREFETCH_WINDOW) {
+        int size = MIN(PREFETCH_WINDOW, count - w);
+        const u64 *window = elements + element_words * w;
+
+        /* hash the whole window and prefetch its slots before inserting,
+           so that the cache misses overlap */
+        for (int e = 0; e < size; e++) {
+            hashes[e] = element_hash(window + element_words * e);
+            dict_prefetch_insert(hashes[e]);
+        }
+        for (int e = 0; e < size; e++)
+            dict->insert(hashes[e], element_value(window + element_words * e));
+    }
+}
+
+/* Insert the elements received in `set` into the dict. The elements are
+   split between all threads of the process, which must all call it. */
+void batch_insert(struct buffer_set *set)
+{
+    for (int i = 0; i < num_processes; i++)
+        insert_elements(set->recv + buffer_size * element_words * i,
+                        set->recv_counts[i]);
+}
+
+/* Check if a solution has been found, resulting in an early exit. */
+int solution_found(int nres)
+{
+    int nres_global;
+    MPI_Allreduce(&nres, &nres_global, EARLY_EXIT_MSG_SIZE,
+                  MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    return nres_global > 0;
+}
+
+/* candidate pairs waiting for verification, private to a thread */
+struct candidates {
+    int count;
+    u64 x[CANDIDATE_BATCH_SIZE];
+    u64 z[CANDIDATE_BATCH_SIZE];
+};
+
+/* Verify a batch of candidate pairs and save the good ones. Returns -1 if
+   there are more than `maxres` solutions. */
+int verify_candidates(int ncand, const u64 cand_x[], const u64 cand_z[],
+                      int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    bool good[CANDIDATE_BATCH_SIZE];
+    int status = 0, ngood = 0;
+
+    double start = wtime();
+    kernel->is_good_pair_batch(cand_x, cand_z, good, ncand);
+    for (int i = 0; i < ncand; i++)
+        ngood += good[i];
+    count_candidates(ncand, ngood, wtime() - start);
+    for (int i = 0; ngood > 0 && i < ncand; i++)
+        if (good[i]) {
+            #pragma omp critical (solutions)
+            {
+                /* the same claw can be found again by the DP search */
+                bool known = false;
+                for (int j = 0; j < *nres; j++)
+                    known |= (k1[j] == cand_x[i] && k2[j] == cand_z[i]);
+                if (!known && *nres == maxres) {
+                    status = -1;
+                } else if (!known) {
+                    k1[*nres] = cand_x[i];
+                    k2[*nres] = cand_z[i];
+                    *nres += 1;
+                }
+            }
+        }
+    return status;
+}
+
+/* Verify the pending candidates of `cand`. */
+static inline void flush_candidates(struct candidates *cand, int *nres,
+                                    int maxres, u64 k1[], u64 k2[])
+{
+    if (cand->count > 0)
+        verify_candidates(cand->count, cand->x, cand->z, nres, maxres, k1, k2);
+    cand->count = 0;
+}
+
+/* Queue the candidate pair (x, z), verifying the queue once it is full. */
+static inline void add_candidate(struct candidates *cand, u64 x, u64 z,
+                                 int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    cand->x[cand->count] = x;
+    cand->z[cand->count] = z;
+    cand->count += 1;
+    if (cand->count == CANDIDATE_BATCH_SIZE)
+        flush_candidates(cand, nres, maxres, k1, k2);
+}
+
+/* Check the `count` (key, value) elements of `elements` against the local
+   dictionary, queueing the candidates in `cand`. They are split between the
+   threads that call it, without a final barrier. Returns the number of
+   candidates found by the calling thread. */
+u64 probe_elements(const u64 *elements, u64 count, struct candidates *cand,
+                   int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    u64 z;
+    u64 x[N_PROBES_MAX];
+    u64 hashes[PREFETCH_WINDOW];
+    u64 ncandidates_partial = 0;
+
+    #pragma omp for schedule(static) nowait
+    for (u64 w = 0; w < count; w += PREFETCH_WINDOW) {
+        int size = MIN(PREFETCH_WINDOW, count - w);
+        const u64 *window = elements + element_words * w;
+
+        /* same group prefetching as in insert_elements */
+        for (int e = 0; e < size; e++) {
+            hashes[e] = element_hash(window + element_words * e);
+            dict_prefetch_probe(hashes[e]);
+        }
+        for (int e = 0; e < size; e++) {
+            z = element_value(window + element_words * e);
+
+            int nx = dict->probe(hashes[e], N_PROBES_MAX, x);
+            assert(nx >= 0);
+            ncandidates_partial += nx;
+            for (int j = 0; j < nx; j++)
+                add_candidate(cand, x[j], z, nres, maxres, k1, k2);
+        }
+    }
+    return ncandidates_partial;
+}
+
+/* Check the elements received in `set` against the local dictionary. The
+   elements are split between all threads of the process, which must all call
+   it. Returns the number of candidates checked by the calling thread. */
+u64 batch_probe(struct buffer_set *set, int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    struct candidates cand = { .count = 0 };
+    u64 ncandidates_partial = 0;
+
+    for (int i = 0; i < num_processes; i++)
+        ncandidates_partial += probe_elements(
+            set->recv + buffer_size * element_words * i,
+            set->recv_counts[i], &cand, nres, maxres, k1, k2);
+    flush_candidates(&cand, nres, maxres, k1, k2);
+
+    return ncandidates_partial;
+}
+
+/***************************** sort-merge join ********************************/
+
+/*
+ * Alternative to the distributed hash table. The (f(x), x) pairs received in
+ * the fill phase are appended to an array F, which is radix-sorted by key once
+ * the phase is complete. The (g(z), z) pairs received in the probe phase are
+ * appended to an array G until it is full; G is then radix-sorted and merged
+ * with F in a single linear scan, and the pairs with equal keys are verified.
+ * All accesses are sequential, at the cost of 16 bytes per pair for F, G and
+ * the scratch space of the sort.
+ */
+struct pair { u64 key; u64 value; };
+
+#define RADIX_BITS              11
+#define RADIX_SIZE              (1 << RADIX_BITS)
+
+enum join { HASH_JOIN, SORT_JOIN } join = HASH_JOIN;
+
+struct pair *F, *G;             /* fill and probe pairs */
+struct pair *sort_tmp;          /* scratch space for the radix sort */
+u64 F_count, G_count;
+u64 join_capacity;              /* maximum number of pairs in F and G */
+u64 *radix_histograms;          /* a histogram per thread */
+
+/* Allocate the arrays of the sort-merge join for up to `size` pairs. */
+void join_setup(u64 size)
+{
+    join_capacity = size;
+    F = malloc(sizeof(*F) * size);
+    G = malloc(sizeof(*G) * size);
+    sort_tmp = malloc(sizeof(*sort_tmp) * size);
+    radix_histograms = malloc(sizeof(*radix_histograms) * RADIX_SIZE * num_threads);
+    if (F == NULL || G == NULL || sort_tmp == NULL || radix_histograms == NULL)
+        err(1, "impossible to allocate the join arrays");
+    F_count = G_count = 0;
+}
+
+/* Sort the `count` pairs of `*src` by key with a LSD radix sort, using `*tmp`
+   as scratch space; the pointers are swapped so that `*src` ends up sorted.
+   It must be called by all threads of the process. */
+void radix_sort(struct pair **src, struct pair **tmp, u64 count)
+{
+    int thread = omp_get_thread_num();
+    u64 lo = count * thread / num_threads;
+    u64 hi = count * (thread + 1) / num_threads;
+    u64 *histogram = radix_histograms + RADIX_SIZE * thread;
+
+    for (int shift = 0; shift < (int) n + check_bits; shift += RADIX_BITS) {
+        struct pair *in = *src, *out = *tmp;
+
+        memset(histogram, 0, sizeof(*histogram) * RADIX_SIZE);
+        for (u64 i = lo; i < hi; i++)
+            histogram[(in[i].key >> shift) & (RADIX_SIZE - 1)] += 1;
+        #pragma omp barrier
+
+        /* turn the histograms into the offsets of each thread, by digit */
+        #pragma omp single
+        {
+            u64 offset = 0;
+            for (int d = 0; d < RADIX_SIZE; d++)
+                for (int t = 0; t < num_threads; t++) {
+                    u64 c = radix_histograms[RADIX_SIZE * t + d];
+                    radix_histograms[RADIX_SIZE * t + d] = offset;
+                    offset += c;
+                }
+        }
+
+        for (u64 i = lo; i < hi; i++)
+            out[histogram[(in[i].key >> shift) & (RADIX_SIZE - 1)]++] = in[i];
+        #pragma omp barrier
+
+        #pragma omp single
+        {
+            *src = out;
+            *tmp = in;
+        }
+    }
+}
+
+/* Append the pairs received in `set` to `dst`, which holds `*count` pairs.
+   It must be called by all threads of the process. */
+void batch_append(struct buffer_set *set, struct pair *dst, u64 *count)
+{
+    u64 offset = *count;
+
+    #pragma omp for schedule(static)
+    for (int i = 0; i < num_processes; i++) {
+        u64 start = offset;
+        for (int j = 0; j < i; j++)
+            start += set->recv_counts[j];
+        if (start + set->recv_counts[i] > join_capacity)
+            errx(1, "too many pairs received for the join arrays");
+        const u64 *buffer = set->recv + buffer_size * element_words * i;
+        for (u64 e = 0; e < set->recv_counts[i]; e++) {
+            dst[start + e].key = element_key(buffer + element_words * e);
+            dst[start + e].value = element_value(buffer + element_words * e);
+        }
+    }
+
+    #pragma omp single
+    for (int i = 0; i < num_processes; i++)
+        *count += set->recv_counts[i];
+}
+
+/* Sort G and merge it with F (which is sorted), verifying the pairs with
+   equal keys, then empty G. It must be called by all threads. */
+void sort_merge_run(int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    struct candidates cand = { .count = 0 };
+
+    radix_sort(&G, &sort_tmp, G_count);
+
+    int thread = omp_get_thread_num();
+    u64 lo = G_count * thread / num_threads;
+    u64 hi = G_count * (thread + 1) / num_threads;
+
+    if (lo < hi) {
+        /* binary search of the first pair of F that may match our part */
+        u64 f = 0, f_end = F_count;
+        while (f < f_end) {
+            u64 mid = f + (f_end - f) / 2;
+            if (F[mid].key < G[lo].key)
+                f = mid + 1;
+            else
+                f_end = mid;
+        }
+
+        for (u64 i = lo; i < hi; i++) {
+            while (f < F_count && F[f].key < G[i].key)
+                f++;
+            for (u64 e = f; e < F_count && F[e].key == G[i].key; e++)
+                add_candidate(&cand, F[e].value, G[i].value, nres, maxres, k1, k2);
+        }
+    }
+    flush_candidates(&cand, nres, maxres, k1, k2);
+
+    #pragma omp barrier
+    #pragma omp single
+    G_count = 0;
+}
+
+/* Append the fill pairs received in `set` to F. */
+void batch_insert_sorted(struct buffer_set *set)
+{
+    batch_append(set, F, &F_count);
+}
+
+/* Append the probe pairs received in `set` to G, merging G with F first if
+   they do not fit. */
+void batch_probe_sorted(struct buffer_set *set, int *nres, int maxres,
+                        u64 k1[], u64 k2[])
+{
+    u64 received = 0;
+    for (int i = 0; i < num_processes; i++)
+        received += set->recv_counts[i];
+
+    if (G_count + received > join_capacity)
+        sort_merge_run(nres, maxres, k1, k2);
+    batch_append(set, G, &G_count);
+}
+
+/* Empty the join arrays for the next round. */
+void join_reset()
+{
+    F_count = G_count = 0;
+}
+
+/****************************** external memory ********************************/
+
+/*
+ * Out-of-core alternative to the rounds (--spill DIR). Instead of recomputing
+ * g for all z in each of the 2**c rounds, both f and g are evaluated once: the
+ * (image, key) pairs are routed to their owner as usual, which hash-partitions
+ * them into 2**c buckets and stages them in a block per bucket and side.
+ * Records are packed in ceil((2n + check_bits) / 8) bytes.
+ * Full blocks are appended to a single run file per side in DIR, each one
+ * starting with the offset and size of the previous block of its bucket, so
+ * that only two files are open whatever c. The buckets are then joined one at
+ * a time, locally, walking their chains of blocks: the f blocks fill the
+ * dictionary (sized as for a round), and the g blocks probe it.
+ */
+#define SPILL_BLOCK_SIZE        65536   /* bytes staged per bucket and side */
+#define SPILL_MIN_BLOCK_SIZE    4096    /* ... when the buckets are many */
+#define SPILL_CHUNK_RECORDS     (1 << 20)   /* records read at once */
+#define SPILL_NONE              (~0ull) /* end of the chain of a bucket */
+
+enum spill_side { SPILL_F, SPILL_G };
+
+/* header of the blocks in the runs */
+struct spill_block_header {
+    u64 prev;                   /* offset of the previous block, or SPILL_NONE */
+    u64 prev_size;              /* and its size */
+};
+
+/* blocks of a bucket on one side */
+struct spill_run {
+    u64 last;                   /* offset of the last block written */
+    u32 last_size;              /* and its size */
+    u32 fill;                   /* bytes used in the staging block */
+};
+
+int num_spill_buckets;
+int spill_record_size;          /* bytes per packed (key, value) record */
+u64 spill_block_size;           /* bytes of the blocks, with their header */
+int spill_fds[2];               /* run of each side, for f and g */
+u64 spill_file_size[2];
+struct spill_run *spill_runs[2];    /* of each bucket */
+u8 *spill_blocks[2];            /* staging block of each bucket */
+u64 spilled_bytes = 0;
+double spill_time = 0;          /* writing and reading the runs */
+
+/* Size of the blocks of the 2**c buckets of a process with `slots` slots in
+   its dictionary: SPILL_BLOCK_SIZE, reduced so that the staging blocks take
+   no more memory than the dictionary, but not below SPILL_MIN_BLOCK_SIZE. */
+u64 spill_block_bytes(u64 slots)
+{
+    u64 size = DICT_SLOT_SIZE * slots / (2ull << compress_factor);
+    return MAX(SPILL_MIN_BLOCK_SIZE, MIN(SPILL_BLOCK_SIZE, size));
+}
+
+/* Memory (in bytes) used by the out-of-core mode of a process with `slots`
+   slots in its dictionary, besides the dictionary and the buffers: the
+   staging blocks and runs of the buckets, and the chunks read back. */
+u64 spill_memory(u64 slots)
+{
+    u64 block = spill_block_bytes(slots);
+    return (2ull << compress_factor) * (block + sizeof(struct spill_run))
+           + block + sizeof(u64) * element_words * SPILL_CHUNK_RECORDS;
+}
+
+/* Bucket of the pairs whose image is `key`, independent of its owner. */
+static inline int spill_bucket(u64 key)
+{
+    return murmur64(~key) & (num_spill_buckets - 1);
+}
+
+/* Name of the run of `side`. */
+void spill_file_name(int side, char *name, size_t size)
+{
+    snprintf(name, size, "%s/%c-rank%d.run", spill_dir, "fg"[side], rank);
+}
+
+/* Create the (empty) runs and the staging blocks of all buckets. */
+void setup_spill()
+{
+    num_spill_buckets = 1 << compress_factor;
+    spill_record_size = (2 * n + check_bits + 7) / 8;
+    spill_block_size = spill_block_bytes(dict_size);
+
+    for (int side = 0; side < 2; side++) {
+        spill_runs[side] = malloc(sizeof(struct spill_run) * num_spill_buckets);
+        spill_blocks[side] = malloc(spill_block_size * num_spill_buckets);
+        if (spill_runs[side] == NULL || spill_blocks[side] == NULL)
+            err(1, "impossible to allocate the spill blocks");
+        for (int b = 0; b < num_spill_buckets; b++) {
+            spill_runs[side][b].last = SPILL_NONE;
+            spill_runs[side][b].last_size = 0;
+            spill_runs[side][b].fill = sizeof(struct spill_block_header);
+        }
+
+        char name[4096];
+        spill_file_name(side, name, sizeof(name));
+        spill_fds[side] = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (spill_fds[side] < 0)
+            err(1, "impossible to create %s", name);
+        spill_file_size[side] = 0;
+    }
+}
+
+/* Append the staging block of `bucket` to the run of `side`, chained to the
+   previous block of the bucket. */
+void spill_flush(int side, int bucket)
+{
+    struct spill_run *run = &spill_runs[side][bucket];
+    if (run->fill == sizeof(struct spill_block_header))
+        return;
+
+    u8 *block = spill_blocks[side] + spill_block_size * bucket;
+    struct spill_block_header header = {run->last, run->last_size};
+    memcpy(block, &header, sizeof(header));
+    if (pwrite(spill_fds[side], block, run->fill, spill_file_size[side])
+        != (ssize_t) run->fill)
+        err(1, "impossible to write a spill run");
+    run->last = spill_file_size[side];
+    run->last_size = run->fill;
+    spill_file_size[side] += run->fill;
+    spilled_bytes += run->fill;
+    run->fill = sizeof(struct spill_block_header);
+}
+
+/* Append the elements received in `set` to the runs of their buckets. They
+   are written by the master thread only. */
+void spill_batch(struct buffer_set *set, int side)
+{
+    #pragma omp master
+    {
+        double start = wtime();
+        for (int i = 0; i < num_processes; i++) {
+            u64 *buffer = set->recv + buffer_size * element_words * i;
+            for (u64 e = 0; e < set->recv_counts[i]; e++) {
+                u64 key = element_key(buffer + element_words * e);
+                u64 value = element_value(buffer + element_words * e);
+                unsigned __int128 record =
+                    key | ((unsigned __int128) value << (n + check_bits));
+                int b = spill_bucket(key);
+                struct spill_run *run = &spill_runs[side][b];
+
+                if (run->fill + spill_record_size > spill_block_size)
+                    spill_flush(side, b);
+                memcpy(spill_blocks[side] + spill_block_size * b + run->fill,
+                       &record, spill_record_size);
+                run->fill += spill_record_size;
+            }
+        }
+        spill_time += wtime() - start;
+    }
+}
+
+/* Read the next blocks of the chain of `side` starting at `cursor` (at most
+   SPILL_CHUNK_RECORDS records) as (key, value) elements, and move the cursor
+   past them. Returns their number. */
+u64 spill_read_chunk(int side, struct spill_run *cursor, u8 *block,
+                     u64 *elements)
+{
+    double start = wtime();
+    u64 block_records = (spill_block_size - sizeof(struct spill_block_header))
+                        / spill_record_size;
+    u64 count = 0;
+    while (cursor->last != SPILL_NONE
+           && count + block_records <= SPILL_CHUNK_RECORDS) {
+        if (pread(spill_fds[side], block, cursor->last_size, cursor->last)
+            != (ssize_t) cursor->last_size)
+            err(1, "impossible to read a spill run");
+        struct spill_block_header header;
+        memcpy(&header, block, sizeof(header));
+
+        u8 *records = block + sizeof(header);
+        u64 records_count = (cursor->last_size - sizeof(header))
+                            / spill_record_size;
+        for (u64 i = 0; i < records_count; i++, count++) {
+            unsigned __int128 record = 0;
+            memcpy(&record, records + spill_record_size * i, spill_record_size);
+            u64 key = (u64) record & image_mask;
+            set_element(elements + element_words * count, murmur64(key), key,
+                        (u64) (record >> (n + check_bits)) & mask);
+        }
+        cursor->last = header.prev;
+        cursor->last_size = header.prev_size;
+    }
+    spill_time += wtime() - start;
+    return count;
+}
+
+/* Join the f and g runs of each bucket in memory. Returns 1 if a solution
+   was found and the search must stop early. */
+int spill_join(int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    u8 *block = malloc(spill_block_size);
+    u64 *elements = malloc(sizeof(u64) * element_words * SPILL_CHUNK_RECORDS);
+    if (block == NULL || elements == NULL)
+        err(1, "impossible to allocate the spill chunks");
+
+    for (int side = 0; side < 2; side++) {
+        for (int b = 0; b < num_spill_buckets; b++)
+            spill_flush(side, b);
+        free(spill_blocks[side]);
+    }
+
+    int early_exit = 0;
+    for (int b = 0; b < num_spill_buckets && !early_exit; b++) {
+        struct spill_run f_cursor = spill_runs[SPILL_F][b];
+        struct spill_run g_cursor = spill_runs[SPILL_G][b];
+        u64 count;
+
+        while ((count = spill_read_chunk(SPILL_F, &f_cursor, block,
+                                         elements)) > 0) {
+            #pragma omp parallel num_threads(num_threads)
+            insert_elements(elements, count);
+        }
+        while ((count = spill_read_chunk(SPILL_G, &g_cursor, block,
+                                         elements)) > 0) {
+            #pragma omp parallel num_threads(num_threads)
+            {
+                struct candidates cand = { .count = 0 };
+                probe_elements(elements, count, &cand, nres, maxres, k1, k2);
+                flush_candidates(&cand, nres, maxres, k1, k2);
+            }
+        }
+
+        double start_reset = wtime();
+        dict_reset();
+        reset_time += wtime() - start_reset;
+        trace_event(TRACE_RESET, start_reset);
+        if (EARLY_EXIT && solution_found(*nres))
+            early_exit = 1;
+    }
+
+    /* the runs are not needed anymore */
+    for (int side = 0; side < 2; side++) {
+        char name[4096];
+        spill_file_name(side, name, sizeof(name));
+        close(spill_fds[side]);
+        unlink(name);
+        free(spill_runs[side]);
+    }
+
+    free(block);
+    free(elements);
+    return early_exit;
+}
+
+/*************************** dynamic load balancing ****************************/
+
+/*
+ * With --dynamic, the keys of a fill or probe sweep are not dealt cyclically
+ * but handed out in chunks: the processes claim the next chunk of the sweep
+ * from a counter held by the root (MPI_Fetch_and_op), and their threads take
+ * grains of WORK_GRAIN keys from the chunk. A process keeps a claimed chunk in
+ * reserve, so that its threads rarely wait for the counter, and the slower
+ * processes simply claim fewer chunks.
+ *
+ * The counters of two consecutive sweeps alternate: the root resets the
+ * counter of the next sweep at the start of a sweep, when all processes are
+ * done claiming in the previous one.
+ */
+
+#define WORK_CHUNKS_PER_PROCESS 64                   /* per sweep, on average */
+#define WORK_GRAIN              (16 * KEY_BATCH_SIZE)  /* taken by a thread */
+
+bool dynamic_mode = false;
+
+MPI_Win work_window;
+u64 *work_counters;             /* next chunk of each sweep (on the root) */
+u64 work_sweeps = 0;            /* sweeps started */
+u64 work_total, work_chunk;     /* keys of the sweep and of a chunk */
+u64 work_next, work_end;        /* keys not taken by the threads yet */
+u64 reserve_next, reserve_end;  /* the next chunk */
+bool work_exhausted;            /* no chunk left in the sweep */
+
+/* statistics */
+u64 keys_swept = 0, chunks_claimed = 0;
+double idle_time = 0;           /* waiting for the other processes */
+
+/* Allocate the counters of the chunks. */
+void setup_work()
+{
+    MPI_Aint size = (rank == ROOT_RANK) ? 2 * sizeof(u64) : 0;
+    MPI_Win_allocate(size, sizeof(u64), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &work_counters, &work_window);
+    if (rank == ROOT_RANK)
+        work_counters[0] = work_counters[1] = 0;
+    MPI_Win_lock_all(0, work_window);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/* Claim the next chunk of the sweep as our reserve. */
+void claim_chunk()
+{
+    const u64 one = 1;
+    u64 chunk;
+
+    MPI_Fetch_and_op(&one, &chunk, MPI_UINT64_T, ROOT_RANK,
+                     (work_sweeps - 1) % 2, MPI_SUM, work_window);
+    MPI_Win_flush(ROOT_RANK, work_window);
+    if (chunk * work_chunk >= work_total) {
+        work_exhausted = true;
+        return;
+    }
+    reserve_next = chunk * work_chunk;
+    reserve_end = MIN(reserve_next + work_chunk, work_total);
+    chunks_claimed += 1;
+}
+
+/* Start handing out the `total` keys of a sweep. */
+void start_work(u64 total)
+{
+    if (rank == ROOT_RANK) {
+        const u64 zero = 0;
+        MPI_Accumulate(&zero, 1, MPI_UINT64_T, ROOT_RANK,
+                       (work_sweeps + 1) % 2, 1, MPI_UINT64_T, MPI_REPLACE,
+                       work_window);
+        MPI_Win_flush(ROOT_RANK, work_window);
+    }
+    work_sweeps += 1;
+
+    work_total = total;
+    work_chunk = MAX(total / ((u64) num_processes * WORK_CHUNKS_PER_PROCESS),
+                     WORK_GRAIN);
+    work_exhausted = false;
+    work_next = work_end = reserve_next = reserve_end = 0;
+    claim_chunk();
+    work_next = reserve_next;
+    work_end = reserve_end;
+    reserve_next = reserve_end = 0;
+    if (!work_exhausted)
+        claim_chunk();
+}
+
+/* Claim a new reserve if ours has been taken. Only the master thread may call
+   it (it makes MPI calls). */
+void refill_work()
+{
+    #pragma omp critical (work)
+    if (!work_exhausted && reserve_next == reserve_end)
+        claim_chunk();
+}
+
+/* Take the next grain of keys [*j, *j_end) for a thread. Returns 1 on
+   success, 0 if the master must claim a chunk first and -1 if the sweep has
+   no keys left. */
+int take_keys(u64 *j, u64 *j_end)
+{
+    int taken;
+
+    #pragma omp critical (work)
+    {
+        if (work_next == work_end && reserve_next < reserve_end) {
+            work_next = reserve_next;
+            work_end = reserve_end;
+            reserve_next = reserve_end = 0;
+        }
+        if (work_next < work_end) {
+            *j = work_next;
+            *j_end = MIN(work_next + WORK_GRAIN, work_end);
+            work_next = *j_end;
+            keys_swept += *j_end - *j;
+            taken = 1;
+        } else {
+            taken = work_exhausted ? -1 : 0;
+        }
+    }
+    return taken;
+}
+
+/****************************** one-sided exchange ******************************/
+
+/*
+ * With --exchange rma, the buffers are not exchanged in collectives where all
+ * processes take part, but pushed with MPI_Put into an inbox of their owner,
+ * a window of INBOX_SLOTS message slots. A sender takes a ticket from the
+ * owner's counter (MPI_Fetch_and_op), waits for the slot of the ticket to be
+ * released, writes the elements and finally publishes the ticket in the
+ * slot. The owner drains its inbox in ticket order whenever it flushes its
+ * own buffers, and releases the slots for the tickets INBOX_SLOTS further. A
+ * process waiting for a slot keeps draining its inbox, so that no cycle of
+ * waiting processes can form. Only the end of a sweep is collective: the
+ * number of messages sent to each process is reduced, and each process
+ * drains its inbox until it received them all.
+ */
+
+/* layout of the inbox window, in words */
+#define INBOX_TAIL              0           /* next ticket */
+#define INBOX_STATE(s)          (1 + (s))   /* ticket the slot is free for */
+#define INBOX_READY(s)          (1 + inbox_slots + (s))  /* ticket + 1 */
+#define INBOX_COUNT(s)          (1 + 2 * inbox_slots + (s))
+#define INBOX_DATA(s)           (1 + 3 * inbox_slots + \
+                                 buffer_size * element_words * (s))
+
+MPI_Win inbox_window;
+u64 *inbox;                     /* our inbox (the window's memory) */
+int inbox_slots;
+u64 inbox_next = 0;             /* next ticket to drain */
+
+u64 *rma_tickets;               /* ticket of the pending push to each process */
+u64 *rma_sent;                  /* messages sent to each process in a sweep */
+u64 *rma_words;                 /* words read from the inboxes */
+u64 rma_expected, rma_received; /* messages to drain in a sweep */
+
+/* statistics */
+u64 rma_messages = 0, rma_stalls = 0;
+
+static const u64 NO_TICKET = 0xffffffffffffffff;
+
+/* Allocate the inboxes, once the buffer size is known. */
+void setup_rma()
+{
+    inbox_slots = NUM_BUFFER_SETS * num_processes;
+    MPI_Win_allocate((MPI_Aint) sizeof(u64) * INBOX_DATA(inbox_slots), sizeof(u64),
+                     MPI_INFO_NULL, MPI_COMM_WORLD, &inbox, &inbox_window);
+    inbox[INBOX_TAIL] = 0;
+    for (int s = 0; s < inbox_slots; s++) {
+        inbox[INBOX_STATE(s)] = s;
+        inbox[INBOX_READY(s)] = 0;
+    }
+
+    rma_tickets = malloc(sizeof(u64) * num_processes);
+    rma_sent = malloc(sizeof(u64) * num_processes);
+    rma_words = malloc(sizeof(u64) * num_processes);
+    if (rma_tickets == NULL || rma_sent == NULL || rma_words == NULL)
+        err(1, "impossible to allocate the inboxes");
+    for (int i = 0; i < num_processes; i++)
+        rma_tickets[i] = NO_TICKET;
+
+    MPI_Win_lock_all(0, inbox_window);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/* Push the non-empty buffers of the set being filled to the inboxes of their
+   owners, as far as their slots are free. Returns the number of buffers
+   still to push. */
+int rma_push()
+{
+    struct buffer_set *set = buffers;
+    const u64 one = 1;
+    int pending = 0;
+
+    /* take a ticket for each new buffer */
+    for (int i = 0; i < num_processes; i++)
+        if (set->send_counts[i] > 0 && rma_tickets[i] == NO_TICKET)
+            MPI_Fetch_and_op(&one, &rma_tickets[i], MPI_UINT64_T, i,
+                             INBOX_TAIL, MPI_SUM, inbox_window);
+    MPI_Win_flush_all(inbox_window);
+
+    /* read the state of their slots */
+    u64 *state = rma_words;
+    for (int i = 0; i < num_processes; i++)
+        if (set->send_counts[i] > 0)
+            MPI_Fetch_and_op(NULL, &state[i], MPI_UINT64_T, i,
+                             INBOX_STATE(rma_tickets[i] % inbox_slots),
+                             MPI_NO_OP, inbox_window);
+    MPI_Win_flush_all(inbox_window);
+
+    /* write the elements in the free slots, then publish the tickets */
+    for (int i = 0; i < num_processes; i++) {
+        if (set->send_counts[i] == 0)
+            continue;
+        if (state[i] != rma_tickets[i]) {
+            pending += 1;
+            continue;
+        }
+        int slot = rma_tickets[i] % inbox_slots;
+        MPI_Put(&set->send_counts[i], 1, MPI_UINT64_T, i, INBOX_COUNT(slot),
+                1, MPI_UINT64_T, inbox_window);
+        MPI_Put(set->send + buffer_size * element_words * i,
+                set->send_counts[i], element_type, i, INBOX_DATA(slot),
+                set->send_counts[i], element_type, inbox_window);
+    }
+    MPI_Win_flush_all(inbox_window);
+    for (int i = 0; i < num_processes; i++) {
+        if (set->send_counts[i] == 0 || state[i] != rma_tickets[i])
+            continue;
+        u64 ready = rma_tickets[i] + 1;
+        MPI_Accumulate(&ready, 1, MPI_UINT64_T, i,
+                       INBOX_READY(rma_tickets[i] % inbox_slots), 1,
+                       MPI_UINT64_T, MPI_REPLACE, inbox_window);
+        elements_sent += set->send_counts[i];
+        rma_sent[i] += 1;
+        rma_messages += 1;
+        set->send_counts[i] = 0;
+        rma_tickets[i] = NO_TICKET;
+    }
+    MPI_Win_flush_all(inbox_window);
+
+    rma_stalls += pending;
+    return pending;
+}
+
+/* Number of messages that can be drained from our inbox, in ticket order. */
+int rma_available()
+{
+    u64 *ready = rma_words;
+    int count = MIN(inbox_slots, num_processes);
+    int available = 0;
+
+    for (int m = 0; m < count; m++)
+        MPI_Fetch_and_op(NULL, &ready[m], MPI_UINT64_T, rank,
+                         INBOX_READY((inbox_next + m) % inbox_slots),
+                         MPI_NO_OP, inbox_window);
+    MPI_Win_flush(rank, inbox_window);
+    while (available < count && ready[available] == inbox_next + available + 1)
+        available += 1;
+    MPI_Win_sync(inbox_window);
+    return available;
+}
+
+/* Insert (fill) or look up (probe) the elements of the next `available`
+   messages of our inbox. It must be called by all threads of the process. */
+void rma_process(int available, enum phase phase, int *nres, int maxres,
+                 u64 k1[], u64 k2[])
+{
+    struct candidates cand = { .count = 0 };
+
+    for (int m = 0; m < available; m++) {
+        int slot = (inbox_next + m) % inbox_slots;
+        u64 *elements = inbox + INBOX_DATA(slot);
+        if (phase == FILL)
+            insert_elements(elements, inbox[INBOX_COUNT(slot)]);
+        else
+            probe_elements(elements, inbox[INBOX_COUNT(slot)], &cand, nres,
+                           maxres, k1, k2);
+    }
+    flush_candidates(&cand, nres, maxres, k1, k2);
+}
+
+/* Release the slots of the `available` messages drained. */
+void rma_release(int available)
+{
+    for (int m = 0; m < available; m++) {
+        int slot = (inbox_next + m) % inbox_slots;
+        u64 state = inbox_next + m + inbox_slots;
+        MPI_Accumulate(&state, 1, MPI_UINT64_T, rank, INBOX_STATE(slot), 1,
+                       MPI_UINT64_T, MPI_REPLACE, inbox_window);
+    }
+    MPI_Win_flush(rank, inbox_window);
+    inbox_next += available;
+    rma_received += available;
+}
+
+/*
+ * The sweep of --exchange rma. The threads compute images as in sweep() until
+ * one of their slices gets full; the master then pushes the buffers while
+ * all threads drain the inbox, without waiting for the other processes.
+ */
+int rma_sweep(enum phase phase, u64 start, u64 stride, u64 total,
+              int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    u64 count = dynamic_mode ? 0 : cyclic_share(total);
+    if (dynamic_mode) {
+        start_work(total);
+    } else {
+        start += rank * stride;
+        stride *= num_processes;
+        keys_swept += count;
+    }
+
+    void (*eval)(const u64 k[], u64 out[], int nkeys) =
+        (phase == FILL) ? kernel->f_batch : kernel->g_batch;
+
+    int exchange_requested = 0;     /* some thread has a full slice */
+    int threads_done = 0;           /* threads that swept all their keys */
+    int pending = 0, available = 0; /* buffers to push, messages to drain */
+    bool finished = false;          /* all messages for us were drained */
+    MPI_Request request;
+
+    for (int i = 0; i < num_processes; i++)
+        rma_sent[i] = 0;
+    rma_received = 0;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int thread = omp_get_thread_num();
+        u64 j = count * thread / num_threads;
+        u64 j_end = count * (thread + 1) / num_threads;
+
+        u64 keys[KEY_BATCH_SIZE], images[KEY_BATCH_SIZE];
+        int nkeys = 0, next = 0;
+        bool done = false;
+
+        for (;;) {
+            /* compute images until one of our buffer slices gets full */
+            double start_event = trace_clock();
+            while (!done) {
+                if (next == nkeys) {
+                    if (j >= j_end) {
+                        int taken = dynamic_mode ? take_keys(&j, &j_end) : -1;
+                        if (taken == 0) {
+                            #pragma omp atomic write
+                            exchange_requested = 1;
+                            break;
+                        }
+                        if (taken < 0) {
+                            done = true;
+                            #pragma omp atomic
+                            threads_done += 1;
+                            break;
+                        }
+                    }
+                    for (nkeys = 0, next = 0; j < j_end && nkeys < KEY_BATCH_SIZE; j++)
+                        keys[nkeys++] = start + j * stride;
+                    eval(keys, images, nkeys);
+                }
+
+                int requested;
+                #pragma omp atomic read
+                requested = exchange_requested;
+                if (requested)
+                    break;
+
+                if (add_to_buffer(thread, images[next], keys[next])) {
+                    next += 1;
+                    #pragma omp atomic write
+                    exchange_requested = 1;
+                    break;
+                }
+                next += 1;
+            }
+
+            trace_event(TRACE_COMPUTE, start_event);
+            start_event = trace_clock();
+            #pragma omp barrier
+            trace_event(TRACE_BARRIER, start_event);
+            compact_buffers();
+            #pragma omp master
+            update_buffer_occupancy_statistics();
+
+            /* push our buffers, draining our inbox meanwhile */
+            bool last;
+            for (;;) {
+                #pragma omp master
+                {
+                    double start_comm = wtime();
+                    pending = rma_push();
+                    available = rma_available();
+                    if (dynamic_mode)
+                        refill_work();
+                    exchange_requested = 0;
+                    communication_time += wtime() - start_comm;
+                    trace_event(TRACE_EXCHANGE, start_comm);
+                }
+                #pragma omp barrier
+                int drained = available, left = pending;
+                last = (left == 0 && threads_done == num_threads);
+                start_event = trace_clock();
+                rma_process(drained, phase, nres, maxres, k1, k2);
+                trace_event(TRACE_DRAIN, start_event);
+                #pragma omp barrier
+                #pragma omp master
+                rma_release(drained);
+                if (left == 0)
+                    break;
+            }
+            if (last)
+                break;
+        }
+
+        /* drain the messages still on their way to us */
+        #pragma omp master
+        MPI_Ireduce_scatter_block(rma_sent, &rma_expected, 1, MPI_UINT64_T,
+                                  MPI_SUM, MPI_COMM_WORLD, &request);
+        for (;;) {
+            #pragma omp master
+            {
+                double start_comm = wtime();
+                int complete;
+                MPI_Test(&request, &complete, MPI_STATUS_IGNORE);
+                available = rma_available();
+                finished = complete
+                           && rma_received + available == rma_expected;
+                communication_time += wtime() - start_comm;
+                idle_time += wtime() - start_comm;
+                trace_event(TRACE_WAIT, start_comm);
+            }
+            #pragma omp barrier
+            int drained = available;
+            bool over = finished;
+            double start_event = trace_clock();
+            rma_process(drained, phase, nres, maxres, k1, k2);
+            trace_event(TRACE_DRAIN, start_event);
+            #pragma omp barrier
+            #pragma omp master
+            rma_release(drained);
+            if (over)
+                break;
+        }
+    }
+
+    /* nobody may push the messages of the next sweep before all inboxes
+       are drained, since they would be drained in this one */
+    double start_comm = wtime();
+    MPI_Barrier(MPI_COMM_WORLD);
+    communication_time += wtime() - start_comm;
+    idle_time += wtime() - start_comm;
+    trace_event(TRACE_WAIT, start_comm);
+
+    /* look for solutions once the sweep is over */
+    if (EARLY_EXIT && phase != FILL && solution_found(*nres))
+        return 1;
+    return 0;
+}
+
+/************************ distinguished points search **************************/
+
+/*
+ * Low-memory alternative to the rounds of the compression algorithm, using the
+ * parallel collision search of van Oorschot and Wiener. Version v of the random
+ * function maps x to f(x) or g(x), depending on a hash of (x, v), and re-masks
+ * the image with a hash of v. A collision between an x mapped with f and a z
+ * mapped with g is a claw f(x) = g(z), which is checked with is_good_pair.
+ *
+ * Each thread walks KEY_BATCH_SIZE chains from random starting points, until
+ * they hit a distinguished point (a fraction 2**-dp_bits of all points). The
+ * pair (distinguished point, start) is sent to the owner of the point, as in
+ * the dictionary, which stores it in a direct-mapped table D of dict_size
+ * slots (the start and a fingerprint of the point, as the dictionary entries).
+ * When two chains reach the same point, the owner walks them again to locate
+ * the collision. Following the golden collision analysis, each version ends
+ * after 10w distinguished points, where w is the size of the global table,
+ * and the function is re-randomized with the next version. About 0.45 * 2**n
+ * / w versions are expected, and the search gives up after
+ * DP_MAX_VERSIONS_FACTOR * 2**n / 10w of them (--dp-versions), in case the
+ * challenge has no golden claw.
+ */
+#define DP_POINTS_PER_SLOT      10      /* distinguished points per version */
+#define DP_MAX_LENGTH_FACTOR    20      /* longer chains are abandoned */
+#define DP_MAX_VERSIONS_FACTOR  50      /* times 2**n / points per version */
+#define DP_MIN_VERSIONS         16      /* the estimate is loose for small n */
+
+bool dp_mode = false;           /* use the distinguished points search */
+u64 *D;                         /* the table of distinguished points */
+int dp_bits;                    /* log2 of the average chain length */
+u64 dp_mask;                    /* distinguished iff hash & dp_mask == 0 */
+u64 dp_max_length;              /* maximum length of a chain */
+u64 dp_version;                 /* version of the random function */
+u64 dp_max_versions = 0;        /* before giving up (0: from n and w) */
+u64 dp_salt;                    /* hash of the version */
+
+/* statistics of the distinguished points search */
+u64 dp_points = 0, dp_collisions = 0, dp_claws = 0;
+
+/* chains walked by a thread */
+struct dp_walker {
+    u64 x[KEY_BATCH_SIZE];      /* current point of each chain */
+    u64 start[KEY_BATCH_SIZE];  /* starting point of each chain */
+    u64 length[KEY_BATCH_SIZE];
+    u64 seed;                   /* of the starting points */
+    u64 counter;
+};
+
+/* Allocate the table of distinguished points for the global table size
+   `size_global`, and derive the parameters of the search from it. */
+void dp_setup(u64 size_global)
+{
+    dict_size = MAX(size_global / num_processes, 1);
+    dict_size_global = dict_size * num_processes;
+    shard_start = rank * dict_size;
+    value_bits = n;
+    if (value_bits > 64 - MIN_FINGERPRINT_BITS)
+        errx(1, "the starting points are too large for the table entries");
+
+    /* distinguished points fraction: 2.25 * sqrt(w / 2**n) */
+    double theta = 2.25 * sqrt((double) dict_size_global / (1ull << n));
+    dp_bits = MAX(0, (int) round(-log2(theta)));
+    dp_mask = (1ull << dp_bits) - 1;
+    dp_max_length = DP_MAX_LENGTH_FACTOR << dp_bits;
+
+    D = alloc_table(sizeof(*D) * dict_size, &dict_pages);
+    if (D == NULL)
+        err(1, "impossible to allocate the table of distinguished points");
+}
+
+/* Switch to the version v of the random function and empty the table. */
+void dp_set_version(u64 v)
+{
+    dp_version = v;
+    dp_salt = murmur64(v + 1);
+    #pragma omp parallel for num_threads(num_threads) schedule(static)
+    for (u64 i = 0; i < dict_size; i++)
+        D[i] = EMPTY;
+}
+
+/* Hash of the point x in the current version; its high bit tells whether x is
+   mapped with g, and its low bits whether x is distinguished. */
+static inline u64 dp_hash(u64 x)
+{
+    return murmur64(x ^ dp_salt);
+}
+
+static inline bool dp_uses_g(u64 h)
+{
+    return h >> 63;
+}
+
+static inline bool dp_distinguished(u64 h)
+{
+    return (h & dp_mask) == 0;
+}
+
+/* One step of the random function of the current version. */
+u64 dp_step(u64 x)
+{
+    u64 y = dp_uses_g(dp_hash(x)) ? g(x) : f(x);
+    return (y ^ dp_salt) & mask;
+}
+
+/* Start a new chain in the slot i of walker w. */
+static inline void dp_new_chain(struct dp_walker *w, int i)
+{
+    w->start[i] = murmur64(w->seed + w->counter) & mask;
+    w->x[i] = w->start[i];
+    w->length[i] = 0;
+    w->counter += 1;
+}
+
+/* Start the chains of `thread` for the current version. */
+void dp_walker_init(struct dp_walker *w, int thread)
+{
+    w->seed = murmur64((dp_version << 32) ^ ((u64) rank * num_threads + thread)) << 20;
+    w->counter = 0;
+    for (int i = 0; i < KEY_BATCH_SIZE; i++)
+        dp_new_chain(w, i);
+}
+
+/* Advance all the chains of w, with the batched kernels, until some of them
+   reach a distinguished point. Write the points and the starts of their chains
+   in dps and starts, restart these chains, and return their number. */
+int dp_walk(struct dp_walker *w, u64 dps[], u64 starts[])
+{
+    u64 keys[2][KEY_BATCH_SIZE], images[2][KEY_BATCH_SIZE];
+    int index[2][KEY_BATCH_SIZE];
+    int count = 0;
+
+    while (count == 0) {
+        int nkeys[2] = {0, 0};
+        for (int i = 0; i < KEY_BATCH_SIZE; i++) {
+            int side = dp_uses_g(dp_hash(w->x[i]));
+            keys[side][nkeys[side]] = w->x[i];
+            index[side][nkeys[side]] = i;
+            nkeys[side] += 1;
+        }
+        kernel->f_batch(keys[0], images[0], nkeys[0]);
+        kernel->g_batch(keys[1], images[1], nkeys[1]);
+
+        for (int side = 0; side < 2; side++)
+            for (int j = 0; j < nkeys[side]; j++) {
+                int i = index[side][j];
+                w->x[i] = (images[side][j] ^ dp_salt) & mask;
+                w->length[i] += 1;
+                if (dp_distinguished(dp_hash(w->x[i]))) {
+                    dps[count] = w->x[i];
+                    starts[count] = w->start[i];
+                    count += 1;
+                    dp_new_chain(w, i);
+                } else if (w->length[i] == dp_max_length) {
+                    dp_new_chain(w, i);
+                }
+            }
+    }
+    return count;
+}
+
+/* Length of the chain from `start` to the distinguished point dp, or 0 if the
+   chain does not reach it (false positive of the fingerprint). */
+u64 dp_chain_length(u64 start, u64 dp)
+{
+    u64 x = start;
+    for (u64 length = 1; length <= dp_max_length; length++) {
+        x = dp_step(x);
+        if (dp_distinguished(dp_hash(x)))
+            return (x == dp) ? length : 0;
+    }
+    return 0;
+}
+
+/* Locate the collision of the chains from a and b, which reach the same
+   distinguished point dp, and queue it if it is a claw. */
+void dp_locate_collision(u64 a, u64 b, u64 dp, struct candidates *cand,
+                         int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    u64 length_a = dp_chain_length(a, dp);
+    u64 length_b = dp_chain_length(b, dp);
+    if (length_a == 0 || length_b == 0)
+        return;
+
+    for (; length_a > length_b; length_a--)
+        a = dp_step(a);
+    for (; length_b > length_a; length_b--)
+        b = dp_step(b);
+    if (a == b)
+        return;     /* a start lies on the other chain */
+
+    for (;;) {
+        u64 next_a = dp_step(a), next_b = dp_step(b);
+        if (next_a == next_b)
+            break;
+        a = next_a;
+        b = next_b;
+    }
+
+    #pragma omp atomic
+    dp_collisions += 1;
+    bool g_a = dp_uses_g(dp_hash(a)), g_b = dp_uses_g(dp_hash(b));
+    if (g_a == g_b)
+        return;
+    #pragma omp atomic
+    dp_claws += 1;
+    if (g_a)
+        add_candidate(cand, b, a, nres, maxres, k1, k2);
+    else
+        add_candidate(cand, a, b, nres, maxres, k1, k2);
+}
+
+/* Store the distinguished points received in `set` in the table, looking for
+   collisions with the points already there. The elements are split between
+   all threads of the process, which must all call it. */
+void dp_batch_insert(struct buffer_set *set, int *nres, int maxres,
+                     u64 k1[], u64 k2[])
+{
+    struct candidates cand = { .count = 0 };
+
+    for (int i = 0; i < num_processes; i++) {
+        u64 *buffer = set->recv + buffer_size * element_words * i;
+        u64 count = set->recv_counts[i];
+
+        #pragma omp for schedule(static) nowait
+        for (u64 e = 0; e < count; e++) {
+            u64 hash = element_hash(buffer + element_words * e);
+            u64 start = element_value(buffer + element_words * e);
+            u64 fp = dict_fingerprint(hash);
+            u64 h = hash_slot(hash) - shard_start;
+
+            /* the new point replaces the old one in its slot */
+            u64 old = __atomic_exchange_n(&D[h], (fp << n) | start,
+                                          __ATOMIC_RELAXED);
+            if (old != EMPTY && old >> n == fp && (old & mask) != start)
+                dp_locate_collision(old & mask, start,
+                                    element_key(buffer + element_words * e),
+                                    &cand, nres, maxres, k1, k2);
+        }
+        /* counted once per process, not per thread */
+        #pragma omp master
+        dp_points += count;
+    }
+    flush_candidates(&cand, nres, maxres, k1, k2);
+}
+
+/* Size of the global table of distinguished points fitting in memory_max GB,
+   with the exchange buffers. */
+u64 dp_table_size(double memory_max)
+{
+    /* the search is pointless with more slots than the exhaustive one */
+    u64 slots = SLOTS_PER_ENTRY * (1ull << n) / num_processes;
+    if (memory_max > 0)
+        while (slots > 1 && RELAXATION_FACTOR * (slots * DICT_SLOT_SIZE +
+               buffers_memory(slots)) * num_processes > memory_max * GB)
+            slots = slots * 15 / 16;
+    return slots * num_processes;
+}
+
+/* Print the amount of data spilled to disk and the time spent on it. */
+void print_spill_statistics()
+{
+    u64 spilled_bytes_global;
+    double spill_time_max;
+
+    MPI_Reduce(&spilled_bytes, &spilled_bytes_global, 1, MPI_UINT64_T,
+               MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+    MPI_Reduce(&spill_time, &spill_time_max, 1, MPI_DOUBLE, MPI_MAX,
+               ROOT_RANK, MPI_COMM_WORLD);
+    if (rank == ROOT_RANK) {
+        char hsize[8];
+        human_format(spilled_bytes_global, hsize);
+        printf("Spilled data: %sB (%d bytes per pair), I/O time: %.2fs\n",
+               hsize, spill_record_size, spill_time_max);
+    }
+}
+
+/* Print the statistics of the distinguished points search. */
+void print_dp_statistics()
+{
+    u64 local[3] = {dp_points, dp_collisions, dp_claws}, global[3];
+
+    MPI_Reduce(local, global, 3, MPI_UINT64_T, MPI_SUM, ROOT_RANK,
+               MPI_COMM_WORLD);
+    if (rank == ROOT_RANK)
+        printf("Distinguished points: %" PRIu64 " versions, %" PRIu64
+               " points, %" PRIu64 " collisions (%" PRIu64 " claws)\n",
+               dp_version + 1, global[0], global[1], global[2]);
+}
+
+/* Memory (in bytes) used by the dictionary or the join arrays of a process
+   with `slots` slots. */
+u64 table_memory(u64 slots)
+{
+    return slots * ((join == SORT_JOIN && !dp_mode) ? 3 * sizeof(struct pair) : DICT_SLOT_SIZE);
+}
+
+/* Memory (in bytes) used by a process out of core (--spill) at the current
+   compression level, staging blocks included. */
+u64 spill_process_memory()
+{
+    u64 slots = SLOTS_PER_ENTRY * (1ull << (n - compress_factor))
+                / num_processes;
+    return table_memory(slots) + buffers_memory(slots) + spill_memory(slots);
+}
+
+/* Set compression factor based on maximum memory available. */
+void set_compression_factor(double memory_max)
+{
+    u64 dict_slots = SLOTS_PER_ENTRY * (1ull << n) / num_processes;
+    u64 memory_required = (table_memory(dict_slots) +
+                           buffers_memory(dict_slots)) * num_processes;
+    // NOTE: We put RELAXATION_FACTOR times the memory requirement as to not
+    // overload the system
+    int minimum_slices = RELAXATION_FACTOR * ceil(memory_required / (memory_max * GB));
+
+    while ((1 << compress_factor) < minimum_slices) {
+        compress_factor++;
+    }
+
+    /* the staging blocks of --spill grow with the buckets: take the lowest
+       level that fits, or else the one using the least memory */
+    if (spill_dir != NULL) {
+        int best = 0;
+        u64 best_memory = ~0ull;
+        for (compress_factor = 0; compress_factor <= (int) n;
+             compress_factor++) {
+            u64 memory = spill_process_memory();
+            if (RELAXATION_FACTOR * memory * num_processes <= memory_max * GB) {
+                best = compress_factor;
+                break;
+            }
+            if (memory < best_memory) {
+                best = compress_factor;
+                best_memory = memory;
+            }
+        }
+        compress_factor = best;
+    }
+}
+
+/* Append check bits to the images when they pay (see f), once the mode and
+   the compression level are known. */
+void setup_check_bits()
+{
+    bool pays = compress_factor <= CHECK_MAX_COMPRESSION || spill_dir != NULL;
+    check_bits = (n > 32 && !dp_mode && pays) ? MIN(CHECK_BITS, 64 - (int) n) : 0;
+    image_mask = (n + check_bits == 64) ? ~0ull : (1ull << (n + check_bits)) - 1;
+}
+
+/* Print execution info for easier debugging. */
+void print_execution_info()
+{
+    if (rank == ROOT_RANK) {
+        if (num_challenges == 1)
+            printf("Running with n=%d, C0=(%08x, %08x) and C1=(%08x, %08x)\n",
+                   (int) n, challenges[0].C[0][0], challenges[0].C[0][1],
+                   challenges[0].C[1][0], challenges[0].C[1][1]);
+        else
+            printf("Running with n=%d and %d challenges\n", (int) n,
+                   num_challenges);
+        printf("Number of processes: %d\n", num_processes);
+        printf("Threads per process: %d\n", num_threads);
+        if (exchange_mode == RMA_EXCHANGE)
+            printf("Exchange: one-sided (%d inbox slots per process)\n",
+                   NUM_BUFFER_SETS * num_processes);
+        else
+            printf("Exchange: %s (%d nodes, %" PRIu64 " inter-node messages "
+                   "per exchange)\n", (exchange_mode == HIER_EXCHANGE) ?
+                   "hierarchical" : "flat", num_nodes, inter_node_messages());
+        printf("Compression level: %d (%d rounds)\n", compress_factor,
+               1 << compress_factor);
+        printf("Kernel: %s %s (%d lanes)\n", CIPHER_NAME, kernel->name,
+               kernel->lanes);
+        if (check_bits > 0)
+            printf("Check bits: %d (images of %d bits)\n", check_bits,
+                   (int) n + check_bits);
+        if (dp_mode)
+            printf("Dictionary: distinguished points (1 in 2^%d points)\n",
+                   dp_bits);
+        else if (dict_load_dir != NULL)
+            printf("Dictionary: %s (mapped from %s)\n", dict->name,
+                   dict_load_dir);
+        else if (spill_dir != NULL)
+            printf("Dictionary: %s (out of core, %d buckets of %" PRIu64
+                   "B blocks in %s)\n", dict->name, 1 << compress_factor,
+                   spill_block_bytes(dict_size), spill_dir);
+        else if (join == HASH_JOIN)
+            printf("Dictionary: %s (%s pages, emptied every %" PRIu64 " rounds)\n",
+                   dict->name, page_kind_names[dict_pages], dict_epochs);
+        else
+            printf("Dictionary: sort-merge join\n");
+
+        char hdsize_global[8], hdsize[8];
+
+        human_format(table_memory(dict_size_global), hdsize_global);
+        human_format(table_memory(dict_size), hdsize);
+        printf("Global dictionary size: %sB (%sB per process%s)\n",
+               hdsize_global, hdsize, weighted_shards ? " on the root" : "");
+
+        human_format(buffers_memory(dict_size_global / num_processes)
+                     * num_processes, hdsize_global);
+        human_format(buffers_memory(dict_size_global / num_processes), hdsize);
+        printf("Total buffer size: %sB (%sB per process)\n",
+               hdsize_global, hdsize);
+    }
+}
+
+/* Print average buffer occupancy. */
+void print_average_buffer_occupancy()
+{
+    /* the processes flush their buffers independently with --exchange rma,
+       so the root sums the numbers of exchanges as well */
+    if (rank == ROOT_RANK) {
+        MPI_Reduce(MPI_IN_PLACE, &cum_buffer_occupancy, 1, MPI_DOUBLE,
+                   MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+        MPI_Reduce(MPI_IN_PLACE, &num_exchanges, 1, MPI_INT, MPI_SUM,
+                   ROOT_RANK, MPI_COMM_WORLD);
+        printf("Average buffer occupancy: %.2f%%\n",
+               cum_buffer_occupancy / num_exchanges * 100);
+    } else {
+        MPI_Reduce(&cum_buffer_occupancy, &cum_buffer_occupancy, 1,
                    MPI_DOUBLE, MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+        MPI_Reduce(&num_exchanges, &num_exchanges, 1, MPI_INT, MPI_SUM,
+                   ROOT_RANK, MPI_COMM_WORLD);
+    }
+}
+
+/* Print the amount of data sent through the exchanges, compared to sending
+   full buffers. */
+void print_exchanged_data()
+{
+    u64 local[2] = {elements_sent, elements_capacity}, global[2];
+
+    MPI_Reduce(local, global, 2, MPI_UINT64_T, MPI_SUM, ROOT_RANK,
+               MPI_COMM_WORLD);
+    if (rank == ROOT_RANK) {
+        char hdata[8], hcapacity[8];
+
+        human_format(global[0] * element_words * sizeof(u64), hdata);
+        human_format(global[1] * element_words * sizeof(u64), hcapacity);
+        printf("Exchanged data: %sB (%sB with full buffers)\n", hdata,
+               hcapacity);
+    }
+}
+
+/* Print the messages pushed with --exchange rma, and the pushes that had
+   to wait for a slot of an inbox. */
+void print_rma_statistics()
+{
+    u64 local[2] = {rma_messages, rma_stalls}, global[2];
+
+    MPI_Reduce(local, global, 2, MPI_UINT64_T, MPI_SUM, ROOT_RANK,
+               MPI_COMM_WORLD);
+    if (rank == ROOT_RANK)
+        printf("One-sided messages: %" PRIu64 " (%" PRIu64 " stalled on a "
+               "full inbox)\n", global[0], global[1]);
+}
+
+/* Print the keys swept by the processes (the points walked, with --dp) and
+   the time they waited for the others in the exchanges. */
+void print_work_statistics()
+{
+    double local[3] = {keys_swept, idle_time, chunks_claimed};
+    double min[3], max[3], sum[3];
+
+    MPI_Reduce(local, min, 3, MPI_DOUBLE, MPI_MIN, ROOT_RANK, MPI_COMM_WORLD);
+    MPI_Reduce(local, max, 3, MPI_DOUBLE, MPI_MAX, ROOT_RANK, MPI_COMM_WORLD);
+    MPI_Reduce(local, sum, 3, MPI_DOUBLE, MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+    if (rank == ROOT_RANK) {
+        printf("Keys per process: min %.0f, max %.0f, mean %.0f",
+               min[0], max[0], sum[0] / num_processes);
+        if (dynamic_mode)
+            printf(" (%.0f chunks claimed)", sum[2]);
+        printf("\nIdle time per process: min %.2fs, max %.2fs, mean %.2fs\n",
+               min[1], max[1], sum[1] / num_processes);
+    }
+}
+
+/* Print the min, mean and max over the processes of their counters and
+   timers (with the rank of the max), and the histogram of the probe lengths
+   when they are counted. */
+void print_telemetry()
+{
+    struct thread_telemetry sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int t = 0; t < num_threads; t++) {
+        sum.candidates += thread_telemetry[t].candidates;
+        sum.good_pairs += thread_telemetry[t].good_pairs;
+        sum.verify_time += thread_telemetry[t].verify_time / num_threads;
+        sum.probes += thread_telemetry[t].probes;
+        sum.probe_slots += thread_telemetry[t].probe_slots;
+        for (int b = 0; b < PROBE_LENGTH_BINS; b++)
+            sum.probe_lengths[b] += thread_telemetry[t].probe_lengths[b];
+    }
+
+    const char *names[] = {"f evaluations", dp_mode ? "points walked"
+                           : "g evaluations", "candidates",
+                           "rejected candidates", "bytes sent", "fill time",
+                           "probe time", "verification time",
+                           "communication time", "exchange wait",
+                           "probe length"};
+    int metrics = TELEMETRY ? 11 : 10;
+    double local[11] = {fill_keys, probe_keys, sum.candidates,
+                        sum.candidates - sum.good_pairs,
+                        elements_sent * element_words * sizeof(u64),
+                        fill_time, probe_time, sum.verify_time,
+                        communication_time, idle_time,
+                        (sum.probes > 0) ? (double) sum.probe_slots / sum.probes
+                        : 0};
+    double min[11], mean[11];
+    struct { double value; int rank; } located[11], max[11];
+    for (int i = 0; i < metrics; i++) {
+        located[i].value = local[i];
+        located[i].rank = rank;
+    }
+    MPI_Reduce(local, min, metrics, MPI_DOUBLE, MPI_MIN, ROOT_RANK,
+               MPI_COMM_WORLD);
+    MPI_Reduce(local, mean, metrics, MPI_DOUBLE, MPI_SUM, ROOT_RANK,
+               MPI_COMM_WORLD);
+    MPI_Reduce(located, max, metrics, MPI_DOUBLE_INT, MPI_MAXLOC, ROOT_RANK,
+               MPI_COMM_WORLD);
+
+    u64 lengths[PROBE_LENGTH_BINS];
+    MPI_Reduce(sum.probe_lengths, lengths, PROBE_LENGTH_BINS, MPI_UINT64_T,
+               MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+
+    if (rank != ROOT_RANK)
+        return;
+    printf("Per process (min / mean / max):\n");
+    for (int i = 0; i < metrics; i++) {
+        mean[i] /= num_processes;
+        printf("  %s: ", names[i]);
+        if (i == 4) {
+            char hmin[8], hmean[8], hmax[8];
+            human_format(min[i], hmin);
+            human_format(mean[i], hmean);
+            human_format(max[i].value, hmax);
+            printf("%sB / %sB / %sB", hmin, hmean, hmax);
+        } else if (i >= 5 && i <= 9) {
+            printf("%.2fs / %.2fs / %.2fs", min[i], mean[i], max[i].value);
+        } else if (i == 10) {
+            printf("%.2f / %.2f / %.2f", min[i], mean[i], max[i].value);
+        } else {
+            printf("%.0f / %.0f / %.0f", min[i], mean[i], max[i].value);
+        }
+        printf(" (rank %d)\n", max[i].rank);
+    }
+    if (TELEMETRY) {
+        u64 probes = 0;
+        int bins = 0;
+        for (int b = 0; b < PROBE_LENGTH_BINS; b++) {
+            probes += lengths[b];
+            if (lengths[b] > 0)
+                bins = b + 1;
+        }
+        printf("Probe lengths (%s read):", (dict->probe == bucket_dict_probe)
+               ? "buckets" : "slots");
+        for (int b = 0; b < bins; b++) {
+            if (b == PROBE_LENGTH_BINS - 1)
+                printf(" %d+", 1 << b);
+            else if (b == 0)
+                printf(" 1");
+            else
+                printf(" %d-%d", 1 << b, (2 << b) - 1);
+            printf(": %.2f%%%s", 100.0 * lengths[b] / MAX(probes, 1),
+                   (b < bins - 1) ? "," : "");
+        }
+        printf("\n");
     }
 }
 
@@ -458,6 +4067,11 @@ void print_execution_times()
         printf("Communication time: %.2fs\n", communication_time);
         printf("Fill time: %.2fs\n", fill_time);
         printf("Probe time: %.2fs\n", probe_time);
+        printf("Reset time: %.3fs\n", reset_time);
+        if (checkpoint_dir != NULL)
+            printf("Checkpoint time: %.2fs (%.1f%% overhead)\n",
+                   checkpoint_time, 100 * checkpoint_time /
+                   (compute_time + communication_time - checkpoint_time));
     }
 }
 
@@ -467,96 +4081,705 @@ void print_statistics_as_structured_data()
     if (rank == ROOT_RANK) {
         printf(">>>%d,%d,%d,%.12f,%.12f,%.12f,%.12f,%.12f\n", (int) n,
                num_processes, compress_factor, compute_time, communication_time,
-               fill_time, probe_time, cum_buffer_occupancy / (num_exchanges
-               * num_processes) * 100);
+               fill_time, probe_time, cum_buffer_occupancy / num_exchanges
+               * 100);
+    }
+}
+
+/* Append the parameters of the run and the keys per second of its phases to
+   report_file: a CSV row (after a header if the file is new) if its name ends
+   with ".csv", a line of JSON otherwise. Must follow
+   print_average_buffer_occupancy(). */
+void write_report()
+{
+    if (report_file == NULL)
+        return;
+    u64 local[2] = {fill_keys, probe_keys}, keys[2];
+    MPI_Reduce(local, keys, 2, MPI_UINT64_T, MPI_SUM, ROOT_RANK,
+               MPI_COMM_WORLD);
+    if (rank != ROOT_RANK)
+        return;
+
+    FILE *file = fopen(report_file, "a");
+    if (file == NULL)
+        err(1, "impossible to open %s", report_file);
+    const char *exchange_names[] = {"flat", "hier", "rma"};
+    const char *method = dp_mode ? "dp" : (spill_dir != NULL) ? "spill"
+                         : (join == SORT_JOIN) ? "sort" : dict->name;
+    double occupancy = (num_exchanges > 0)
+                       ? cum_buffer_occupancy / num_exchanges : 0;
+    double fill_rate = (fill_time > 0) ? keys[0] / fill_time : 0;
+    double probe_rate = (probe_time > 0) ? keys[1] / probe_time : 0;
+
+    size_t len = strlen(report_file);
+    if (len >= 4 && strcmp(report_file + len - 4, ".csv") == 0) {
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) == 0)
+            fprintf(file, "n,processes,threads,compression,exchange,dict,"
+                    "kernel,dynamic,fill_keys,probe_keys,fill_time,"
+                    "probe_time,compute_time,communication_time,"
+                    "fill_keys_per_s,probe_keys_per_s,buffer_occupancy\n");
+        fprintf(file, "%d,%d,%d,%d,%s,%s,%s,%d,%" PRIu64 ",%" PRIu64 ",%.6f,"
+                "%.6f,%.6f,%.6f,%.0f,%.0f,%.4f\n", (int) n, num_processes,
+                num_threads, compress_factor, exchange_names[exchange_mode],
+                method, kernel->name, dynamic_mode, keys[0], keys[1],
+                fill_time, probe_time, compute_time, communication_time,
+                fill_rate, probe_rate, occupancy);
+    } else {
+        fprintf(file, "{\"n\": %d, \"processes\": %d, \"threads\": %d, "
+                "\"compression\": %d, \"exchange\": \"%s\", \"dict\": \"%s\", "
+                "\"kernel\": \"%s\", \"dynamic\": %s, \"fill_keys\": %" PRIu64
+                ", \"probe_keys\": %" PRIu64 ", \"fill_time\": %.6f, "
+                "\"probe_time\": %.6f, \"compute_time\": %.6f, "
+                "\"communication_time\": %.6f, \"fill_keys_per_s\": %.0f, "
+                "\"probe_keys_per_s\": %.0f, \"buffer_occupancy\": %.4f}\n",
+                (int) n, num_processes, num_threads, compress_factor,
+                exchange_names[exchange_mode], method, kernel->name,
+                dynamic_mode ? "true" : "false", keys[0], keys[1], fill_time,
+                probe_time, compute_time, communication_time, fill_rate,
+                probe_rate, occupancy);
+    }
+    fclose(file);
+}
+
+/******************************** run planner *********************************/
+
+/*
+ * The buffers are sized from a cost model of the exchanges. An exchange costs
+ * about `exchange_latency` plus `byte_cost` per byte, and each thread handles
+ * an element of a fill (resp. probe) in `fill_cost` (resp. `probe_cost`)
+ * seconds: evaluation of f (g) on a key, then insert (probe) on the receiving
+ * side. A thread fills its slices after producing about buffer_fill * P
+ * elements, so flushing them at
+ *
+ *     buffer_fill = exchange_latency / (EXCHANGE_OVERHEAD * cost * P)
+ *
+ * elements keeps the latency of the exchanges below EXCHANGE_OVERHEAD of the
+ * time spent on their elements, while smaller exchanges overlap better and
+ * leave less imbalance at the end of a sweep. The fill is capped by the
+ * capacity of the buffers allocated for the --mem budget.
+ *
+ * calibrate() measures the costs at startup, on the empty dictionary; after
+ * each sweep, tune_buffers() updates the latency and the cost of its phase
+ * from its timers, and the next sweep uses the new fill. All processes use
+ * the largest costs, so that they flush their buffers alike. With --plan, the
+ * same model predicts the memory, rounds and running time of a search, the
+ * costs being measured on a table filled as in a round.
+ */
+#ifndef BUFFER_TUNING
+#define BUFFER_TUNING           1       /* 0 flushes full buffers only */
+#endif
+#define EXCHANGE_OVERHEAD       0.01
+#define MIN_BUFFER_FILL         KEY_BATCH_SIZE
+#define CALIBRATION_EXCHANGES   16
+#define CALIBRATION_KEYS        (1 << 16)
+#define CALIBRATION_WORDS       (1 << 20)   /* all-to-all of 8MB per process */
+#define PLAN_TABLE_SLOTS        (1ull << 23)
+
+double exchange_latency = 0;    /* seconds per exchange */
+double byte_cost = 0;           /* seconds per byte sent */
+double fill_cost = 0;           /* seconds per element of a fill, per thread */
+double probe_cost = 0;          /* ... of a probe (or a walk) */
+double verify_cost = 0;         /* seconds per candidate verified */
+u64 initial_buffer_fill = 0;    /* fill of the first sweep */
+int plan_processes = 0;         /* predict a search with this many processes */
+
+/* snapshot of the timers at the start of a sweep */
+struct sweep_mark {
+    enum phase phase;
+    double time;
+    double communication_time;
+    u64 keys_swept;
+    int num_exchanges;
+};
+
+/* Elements of a slice of `capacity` elements that trigger an exchange with
+   `processes` processes, for elements of `cost` seconds. */
+u64 tuned_buffer_fill(int processes, u64 capacity, double cost)
+{
+    if (!BUFFER_TUNING || cost <= 0)
+        return capacity;
+    double fill = exchange_latency / (EXCHANGE_OVERHEAD * cost * processes);
+    return MIN((double) capacity, MAX(fill, MIN_BUFFER_FILL));
+}
+
+/* Seconds per key to evaluate f (FILL) or g on `num_keys` keys, and insert or
+   probe their images in the local dictionary if `use_dict` is set. */
+double element_cost(enum phase phase, u64 num_keys, bool use_dict)
+{
+    void (*eval)(const u64 k[], u64 out[], int nkeys) =
+        (phase == FILL) ? kernel->f_batch : kernel->g_batch;
+    u64 keys[KEY_BATCH_SIZE], images[KEY_BATCH_SIZE], values[N_PROBES_MAX];
+
+    /* the local shard is used as a whole table */
+    u64 size_global = dict_size_global, start_slot = shard_start;
+    dict_size_global = dict_size;
+    shard_start = 0;
+    double start = wtime();
+    for (u64 i = 0; i < num_keys; i += KEY_BATCH_SIZE) {
+        int nkeys = MIN(KEY_BATCH_SIZE, num_keys - i);
+        for (int k = 0; k < nkeys; k++)
+            keys[k] = (i + k) & mask;
+        eval(keys, images, nkeys);
+        for (int k = 0; use_dict && k < nkeys; k++) {
+            u64 hash = murmur64(images[k]);
+            if (phase == FILL)
+                dict->insert(hash, keys[k]);
+            else
+                dict->probe(hash, N_PROBES_MAX, values);
+        }
     }
+    double cost = (wtime() - start) / MAX(num_keys, 1);
+    dict_size_global = size_global;
+    shard_start = start_slot;
+    return cost;
+}
+
+/* Measure the latency and bandwidth of the all-to-all exchanges, and the cost
+   of the elements, inserting `fill_keys` keys in the dictionary (when there
+   is one to write in), which is emptied afterwards. */
+void calibrate(u64 fill_keys)
+{
+    u64 words = MAX(CALIBRATION_WORDS / num_processes, 1);
+    u64 *send = calloc(words * num_processes, sizeof(u64));
+    u64 *recv = malloc(sizeof(u64) * words * num_processes);
+    if (send == NULL || recv == NULL)
+        err(1, "impossible to allocate the calibration buffers");
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = wtime();
+    for (int i = 0; i < CALIBRATION_EXCHANGES; i++)
+        MPI_Alltoall(send, 1, MPI_UINT64_T, recv, 1, MPI_UINT64_T,
+                     MPI_COMM_WORLD);
+    double latency = (wtime() - start) / CALIBRATION_EXCHANGES;
+    start = wtime();
+    for (int i = 0; i < CALIBRATION_EXCHANGES; i++)
+        MPI_Alltoall(send, words, MPI_UINT64_T, recv, words, MPI_UINT64_T,
+                     MPI_COMM_WORLD);
+    double transfer = (wtime() - start) / CALIBRATION_EXCHANGES - latency;
+    free(send);
+    free(recv);
+
+    bool use_dict = join == HASH_JOIN && !dp_mode && dict_load_dir == NULL;
+    if (!use_dict)
+        fill_keys = CALIBRATION_KEYS;
+    double fill = element_cost(FILL, fill_keys, use_dict);
+    double probe = element_cost(PROBE, CALIBRATION_KEYS, use_dict);
+    if (use_dict)
+        dict_reset();
+
+    bool good[CANDIDATE_BATCH_SIZE];
+    u64 x[CANDIDATE_BATCH_SIZE], z[CANDIDATE_BATCH_SIZE];
+    for (int i = 0; i < CANDIDATE_BATCH_SIZE; i++)
+        x[i] = z[i] = i;
+    start = wtime();
+    for (int i = 0; i < CALIBRATION_KEYS; i += CANDIDATE_BATCH_SIZE)
+        kernel->is_good_pair_batch(x, z, good, CANDIDATE_BATCH_SIZE);
+    double verify = (wtime() - start) / CALIBRATION_KEYS;
+
+    double local[5] = {latency, MAX(transfer, 0) / (8.0 * words * num_processes),
+                       fill, probe, verify}, global[5];
+    MPI_Allreduce(local, global, 5, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    exchange_latency = global[0];
+    byte_cost = global[1];
+    fill_cost = global[2];
+    probe_cost = global[3];
+    verify_cost = global[4];
+}
+
+/* Take a snapshot of the timers, and set the fill of the sweep starting. */
+void start_sweep_tuning(struct sweep_mark *mark, enum phase phase)
+{
+    mark->phase = phase;
+    mark->time = wtime();
+    mark->communication_time = communication_time;
+    mark->keys_swept = keys_swept;
+    mark->num_exchanges = num_exchanges;
+    buffer_fill = tuned_buffer_fill(num_processes, thread_buffer_size,
+                                    (phase == FILL) ? fill_cost : probe_cost);
+    if (initial_buffer_fill == 0)
+        initial_buffer_fill = buffer_fill;
+}
+
+/* Update the latency and the cost of the phase with the timers of the sweep
+   started at `mark`, giving the same weight to the previous estimates. */
+void tune_buffers(const struct sweep_mark *mark)
+{
+    double comm = communication_time - mark->communication_time;
+    double elapsed = wtime() - mark->time;
+    int exchanges = num_exchanges - mark->num_exchanges;
+    u64 keys = keys_swept - mark->keys_swept;
+
+    double local[2] = {0, 0}, global[2];
+    if (exchanges > 0)
+        local[0] = comm / exchanges;
+    if (keys > 0)
+        local[1] = MAX(elapsed - comm, 0) * num_threads / keys;
+    MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    double *cost = (mark->phase == FILL) ? &fill_cost : &probe_cost;
+    if (global[0] > 0)
+        exchange_latency = (exchange_latency + global[0]) / 2;
+    if (global[1] > 0)
+        *cost = (*cost + global[1]) / 2;
+}
+
+/* Print the costs measured by calibrate(). */
+void print_calibration()
+{
+    if (rank == ROOT_RANK)
+        printf("Calibration: exchange latency %.1fus, bandwidth %.2fGB/s, "
+               "%.1fns per fill element, %.1fns per probe element\n",
+               exchange_latency * 1e6, (byte_cost > 0) ? 1e-9 / byte_cost
+               : INFINITY, fill_cost * 1e9, probe_cost * 1e9);
+}
+
+/* Print the fill of the buffers, at the start and end of the search. */
+void print_buffer_tuning()
+{
+    if (rank == ROOT_RANK)
+        printf("Buffer fill: %" PRIu64 " elements per slice at start, %" PRIu64
+               " at the end (capacity %" PRIu64 ")\n", initial_buffer_fill,
+               buffer_fill, thread_buffer_size);
+}
+
+/* Print the memory, rounds and running time predicted for a search with
+   plan_processes processes (and the --threads and --mem of this run), from
+   the costs measured with the processes of this run. The latency of an
+   all-to-all is assumed to grow linearly with the number of processes. */
+void print_plan()
+{
+    int actual_processes = num_processes;
+    num_processes = plan_processes;
+    compress_factor = 0;
+    if (memory_max > 0)
+        set_compression_factor(memory_max);
+    setup_check_bits();
+    u64 slots = ceil(SLOTS_PER_ENTRY * (1ull << (n - compress_factor))
+                     / num_processes);
+    u64 table = table_memory(slots), buffers = buffers_memory(slots);
+    u64 capacity = MAX(GET_BUFFER_SIZE(slots) / num_threads, 1);
+    num_processes = actual_processes;
+
+    /* measure the costs on a table as large as the planned shard (up to
+       PLAN_TABLE_SLOTS slots), filled up to the same load */
+    dict_size = dict_size_global = MIN(slots, PLAN_TABLE_SLOTS);
+    shard_start = 0;
+    if (join == HASH_JOIN)
+        dict_setup(dict_size);
+    calibrate(dict_size / SLOTS_PER_ENTRY);
+    exchange_latency *= (double) plan_processes / actual_processes;
+
+    /* the rounds fill the dictionary with 2**n keys in all, and probe it with
+       2**n keys per challenge each, verifying 2**-(c + check_bits) candidates
+       per probe */
+    int rounds = 1 << compress_factor;
+    int challenges = MAX(num_challenges, 1);
+    double N = (double) (1ull << n) / plan_processes;
+    double fills = N, probes = N * rounds * challenges;
+    double probe = probe_cost + ldexp(verify_cost / rounds, -check_bits);
+    u64 fill_fill = tuned_buffer_fill(plan_processes, capacity, fill_cost);
+    u64 probe_fill = tuned_buffer_fill(plan_processes, capacity, probe);
+    double exchanges = (fills / fill_fill + probes / probe_fill)
+                       / (num_threads * plan_processes)
+                       + 2 * rounds * (1 + challenges);
+    double compute = (fills * fill_cost + probes * probe) / num_threads;
+    double comm = exchanges * exchange_latency
+                  + (fills + probes) * element_words * sizeof(u64) * byte_cost;
+
+    if (rank != ROOT_RANK)
+        return;
+    char htable[8], hbuffers[8], htotal[8];
+    human_format(table, htable);
+    human_format(buffers, hbuffers);
+    human_format((table + buffers) * plan_processes, htotal);
+    printf("Plan for n=%d with %d processes of %d threads", (int) n,
+           plan_processes, num_threads);
+    if (memory_max > 0)
+        printf(" and %.1fGB of memory", memory_max);
+    printf(":\n");
+    print_calibration();
+    printf("Compression level: %d (%d rounds)\n", compress_factor, rounds);
+    printf("Memory per process: %sB of table and %sB of buffers "
+           "(%sB in total)\n", htable, hbuffers, htotal);
+    printf("Buffer fill: %" PRIu64 " elements per slice for the fills, %"
+           PRIu64 " for the probes (capacity %" PRIu64 ")\n", fill_fill,
+           probe_fill, capacity);
+    printf("Predicted time: %.0fs (%.0fs of computation, %.0fs of "
+           "communication in %.0f exchanges)\n", compute + comm, compute, comm,
+           exchanges);
 }
 
 /******************************************************************************/
 
-/* search the "golden collision" */
-int golden_claw_search(int maxres, u64 k1[], u64 k2[])
+/*
+ * Sweep the keys start + i * stride (0 <= i < total) assigned to this process,
+ * i.e. those with i equal to rank modulo num_processes, or the chunks it
+ * claims with --dynamic: evaluate f (fill) or g (probe) on them, send their
+ * images to the processes owning them and insert (fill) or look up (probe)
+ * the received elements. In the WALK phase, each process walks its share of
+ * the `total` points instead.
+ *
+ * The keys are split between the threads of the process, which stage their
+ * elements in their own buffer slices. As soon as a slice holds buffer_fill
+ * elements (see the run planner), all the threads stop and the master thread starts exchanging the buffers (it is the
+ * only one making MPI calls). The exchanges are pipelined with two buffer
+ * sets: while one set is in flight, the threads process the elements received
+ * in the previous exchange and fill the other set.
+ *
+ * Each process flags its last exchange with elements, and the sweep ends once
+ * an exchange where all processes were done has been processed, so that all
+ * of them agree on the number of exchanges. Returns 1 if a solution has been
+ * found and the search must stop early.
+ */
+int collective_sweep(enum phase phase, u64 start, u64 stride, u64 total,
+                     int *nres, int maxres, u64 k1[], u64 k2[])
+{
+    bool dynamic = dynamic_mode && phase != WALK;
+    u64 count = dynamic ? 0 : cyclic_share(total);
+    if (dynamic) {
+        start_work(total);
+    } else {
+        start += rank * stride;
+        stride *= num_processes;
+        keys_swept += count;
+    }
+
+    void (*eval)(const u64 k[], u64 out[], int nkeys) =
+        (phase == FILL) ? kernel->f_batch : kernel->g_batch;
+
+    int exchange_requested = 0;     /* some thread has a full slice */
+    int threads_done = 0;           /* threads that swept all their keys */
+    bool last_exchange = false;     /* all processes are done */
+    int early_exit = 0;
+
+    struct buffer_set *in_flight = NULL;    /* exchange being performed */
+    struct buffer_set *received = NULL;     /* exchange to be processed */
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int thread = omp_get_thread_num();
+        u64 j = count * thread / num_threads;
+        u64 j_end = count * (thread + 1) / num_threads;
+        if (phase == PROBE && resume_cursors != NULL)
+            j = resume_cursors[thread];
+
+        /* keys are evaluated in batches to use the vectorized kernels */
+        u64 keys[KEY_BATCH_SIZE], images[KEY_BATCH_SIZE];
+        int nkeys = 0, next = 0;
+        bool done = false;
+
+        /* in the WALK phase, images are distinguished points and keys the
+           starts of their chains */
+        struct dp_walker walker;
+        if (phase == WALK)
+            dp_walker_init(&walker, thread);
+
+        for (;;) {
+            /* process the previous exchange while the last one is in flight */
+            double start_event = trace_clock();
+            if (received != NULL) {
+                if (spill_dir != NULL)
+                    spill_batch(received, (phase == FILL) ? SPILL_F : SPILL_G);
+                else if (phase == FILL && join == HASH_JOIN)
+                    batch_insert(received);
+                else if (phase == FILL)
+                    batch_insert_sorted(received);
+                else if (phase == WALK)
+                    dp_batch_insert(received, nres, maxres, k1, k2);
+                else if (join == HASH_JOIN)
+                    batch_probe(received, nres, maxres, k1, k2);
+                else
+                    batch_probe_sorted(received, nres, maxres, k1, k2);
+                trace_event(TRACE_DRAIN, start_event);
+            }
+            if (received != NULL && received->checkpoint) {
+                /* the pending probes of the sort-merge join come first */
+                if (join == SORT_JOIN)
+                    sort_merge_run(nres, maxres, k1, k2);
+                #pragma omp barrier
+                #pragma omp master
+                write_checkpoint(received->cursors);
+                #pragma omp barrier
+            }
+            if (last_exchange)
+                break;
+
+            /* compute images until one of our buffer slices gets full */
+            start_event = trace_clock();
+            while (!done) {
+                if (next == nkeys) {
+                    if (j >= j_end) {
+                        /* a thread out of keys waits for the master to
+                           claim a chunk at the next exchange */
+                        int taken = dynamic ? take_keys(&j, &j_end) : -1;
+                        if (taken == 0) {
+                            #pragma omp atomic write
+                            exchange_requested = 1;
+                            break;
+                        }
+                        if (taken < 0) {
+                            done = true;
+                            #pragma omp atomic
+                            threads_done += 1;
+                            break;
+                        }
+                    }
+                    if (phase == WALK) {
+                        nkeys = dp_walk(&walker, images, keys);
+                        next = 0;
+                        j += nkeys;
+                    } else {
+                        for (nkeys = 0, next = 0; j < j_end && nkeys < KEY_BATCH_SIZE; j++)
+                            keys[nkeys++] = start + j * stride;
+                        eval(keys, images, nkeys);
+                    }
+                    if (thread == 0 && in_flight != NULL)
+                        progress_exchange(in_flight);
+                    if (thread == 0 && dynamic)
+                        refill_work();
+                }
+
+                int requested;
+                #pragma omp atomic read
+                requested = exchange_requested;
+                if (requested)
+                    break;
+
+                if (add_to_buffer(thread, images[next], keys[next])) {
+                    next += 1;
+                    #pragma omp atomic write
+                    exchange_requested = 1;
+                    break;
+                }
+                next += 1;
+            }
+
+            /* the keys before the cursor are in this exchange or before */
+            buffers->cursors[thread] = j - (nkeys - next);
+            trace_event(TRACE_COMPUTE, start_event);
+            start_event = trace_clock();
+            #pragma omp barrier
+            trace_event(TRACE_BARRIER, start_event);
+            compact_buffers();
+            #pragma omp master
+            {
+                double start_comm = wtime();
+                received = in_flight;
+                in_flight = NULL;
+                double start_wait = wtime();
+                if (received != NULL && wait_exchange(received))
+                    last_exchange = true;
+                idle_time += wtime() - start_wait;
+                trace_event(TRACE_WAIT, start_wait);
+                if (dynamic)
+                    refill_work();
+                /* all processes see the same FOUND_FLAGs in an exchange, so
+                   they stop together without a separate reduction */
+                if (EARLY_EXIT && phase != FILL && received != NULL
+                    && received->any_found)
+                    early_exit = 1;
+                else if (!last_exchange) {
+                    u64 flags = 0;
+                    if (threads_done == num_threads)
+                        flags |= DONE_FLAG;
+                    if (phase != FILL && *nres > 0)
+                        flags |= FOUND_FLAG;
+                    if (phase == PROBE && rank == ROOT_RANK && checkpoint_due())
+                        flags |= CHECKPOINT_FLAG;
+                    in_flight = buffers;
+                    exchange_buffers(flags);
+                }
+                exchange_requested = 0;
+                communication_time += wtime() - start_comm;
+                trace_event(TRACE_EXCHANGE, start_comm);
+            }
+            start_event = trace_clock();
+            #pragma omp barrier
+            trace_event(TRACE_BARRIER, start_event);
+
+            if (early_exit)
+                break;
+        }
+
+        /* the sort-merge join sorts F, or merges the last pairs of G */
+        if (join == SORT_JOIN && phase != WALK && !early_exit) {
+            if (phase == FILL)
+                radix_sort(&F, &sort_tmp, F_count);
+            else
+                sort_merge_run(nres, maxres, k1, k2);
+        }
+    }
+
+    /* look for solutions in the last exchange */
+    if (EARLY_EXIT && phase != FILL && !early_exit && solution_found(*nres))
+        early_exit = 1;
+
+    return early_exit;
+}
+
+/* Sweep with the exchanges of the run (collective or one-sided), and tune the
+   buffers with its timers. */
+int sweep(enum phase phase, u64 start, u64 stride, u64 total,
+          int *nres, int maxres, u64 k1[], u64 k2[])
 {
-    int nres = 0;
+    struct sweep_mark mark;
+    double start_event = trace_clock();
+    start_sweep_tuning(&mark, phase);
+    int early_exit = (exchange_mode == RMA_EXCHANGE)
+        ? rma_sweep(phase, start, stride, total, nres, maxres, k1, k2)
+        : collective_sweep(phase, start, stride, total, nres, maxres, k1, k2);
+    tune_buffers(&mark);
+    if (phase == FILL)
+        fill_keys += keys_swept - mark.keys_swept;
+    else
+        probe_keys += keys_swept - mark.keys_swept;
+    trace_event(phase, start_event);
+    return early_exit;
+}
 
+/* search the "golden collision" of each challenge */
+void golden_claw_search(int maxres)
+{
     /* step 0: initialize buffers */
     setup_buffers();
+    if (exchange_mode == RMA_EXCHANGE)
+        setup_rma();
+    if (dynamic_mode)
+        setup_work();
+    setup_checkpoints();
 
     int num_rounds = 1 << compress_factor;
     u64 N = 1ull << n;
     u64 xs_per_round = N >> compress_factor;
+    int remaining = 0;
+    for (int i = 0; i < num_challenges; i++)
+        remaining += !challenges[i].done;
 
     double start_program = wtime();
-    for (int round = 0; round < num_rounds; round++) {
-        /* step 1: fill up the dictionaries (using cyclic load balancing) */
+    for (int round = position.round; round < num_rounds; round++) {
+        dict_round = round;
+
+        /* step 1: fill up the dictionaries (using cyclic or dynamic load
+           balancing), or map the shards saved by a previous run, or read
+           the shard saved with the checkpoint we resume from */
         double start_fill = wtime();
-        u64 xs_per_process = xs_per_round / num_processes;
-        u64 x_start = num_rounds * rank + round;
-        u64 x_end = x_start + xs_per_process * num_processes * num_rounds;
-
-        for (u64 x = x_start; x < x_end; x += num_processes * num_rounds) {
-            u64 z = f(x);
-            if (add_to_buffer(z, x)) {
-                time_comm(exchange_buffers);
-                batch_insert();
-            }
+        if (dict_load_dir != NULL) {
+            load_dict(round);
+        } else if (position.dict_saved) {
+            read_dict(checkpoint_dir, round);
+        } else {
+            sweep(FILL, round, num_rounds, xs_per_round, NULL, 0, NULL, NULL);
+            if (dict_save_dir != NULL)
+                save_dict(dict_save_dir, round);
         }
-
-        /* set barrier informing that all the elements have been computed */
-        MPI_Request fill_barrier;
-        int all_fills_complete = 0;
-        MPI_Ibarrier(MPI_COMM_WORLD, &fill_barrier);
-
-        /* receive elements from other processes */
-        do {
-            time_comm(exchange_buffers);
-            batch_insert();
-            MPI_Test(&fill_barrier, &all_fills_complete, MPI_STATUS_IGNORE);
-        } while (!all_fills_complete);
         fill_time += wtime() - start_fill;
+        position.filled = 1;
+        if (checkpoint_dir != NULL && checkpoint_dict && !position.dict_saved) {
+            double start_checkpoint = wtime();
+            save_dict(checkpoint_dir, round);
+            checkpoint_time += wtime() - start_checkpoint;
+            position.dict_saved = 1;
+            write_checkpoint(NULL);
 
-        /* step 2: probe the dictionaries (also with cyclic load balancing) */
-        double start_probe = wtime();
-        u64 zs_per_process = N / num_processes;
-        u64 z_start = rank;
-        u64 z_end = z_start + zs_per_process * num_processes;
-
-        for (u64 z = z_start; z < z_end; z += num_processes) {
-            u64 y = g(z);
-            if (add_to_buffer(y, z)) {
-                time_comm(exchange_buffers);
-                batch_probe(&nres, maxres, k1, k2);
-                if (solution_found(nres) && EARLY_EXIT) {
-                    probe_time += wtime() - start_probe;
-                    compute_time = (wtime() - start_program) - communication_time;
-                    return nres;
-                }
-            }
+            /* the checkpoints in both slots are past the previous round */
+            char name[4096];
+            dict_file_name(checkpoint_dir, round - 1, name, sizeof(name));
+            if (round > 0)
+                unlink(name);
         }
 
-        /* same non-blocking barrier strategy from the fill phase */
-        all_fills_complete = 0;
-        MPI_Ibarrier(MPI_COMM_WORLD, &fill_barrier);
-
-        do {
-            time_comm(exchange_buffers);
-            batch_probe(&nres, maxres, k1, k2);
-            if (solution_found(nres) && EARLY_EXIT) {
-                probe_time += wtime() - start_probe;
-                compute_time = (wtime() - start_program) - communication_time;
-                return nres;
+        /* step 2: probe the dictionaries (also with cyclic load balancing),
+           once per challenge */
+        double start_probe = wtime();
+        for (int i = position.challenge; i < num_challenges; i++) {
+            struct challenge *c = &challenges[i];
+            position.challenge = i;
+            if (c->done)
+                continue;
+            select_challenge(c);
+            if (sweep(PROBE, 0, 1, N, &c->nres, maxres, c->k1, c->k2)) {
+                c->done = true;
+                remaining -= 1;
             }
-            MPI_Test(&fill_barrier, &all_fills_complete, MPI_STATUS_IGNORE);
-        } while (!all_fills_complete);
+            free(resume_cursors);
+            resume_cursors = NULL;
+        }
         probe_time += wtime() - start_probe;
+        if (num_challenges > 0 && remaining == 0)
+            break;
+
+        /* the next round starts from scratch */
+        position.round = round + 1;
+        position.challenge = 0;
+        position.filled = position.dict_saved = 0;
+        if (checkpoint_dir != NULL)
+            write_checkpoint(NULL);
 
         /* reset dictionaries */
-        for (u64 i = 0; i < dict_size; i++)
-            A[i].k = EMPTY;
+        double start_reset = wtime();
+        if (dict_load_dir != NULL)
+            continue;
+        else if (join == HASH_JOIN)
+            dict_reset();
+        else
+            join_reset();
+        reset_time += wtime() - start_reset;
+        trace_event(TRACE_RESET, start_reset);
     }
 
     compute_time = (wtime() - start_program) - communication_time;
-    return nres;
+}
+
+/* Search the "golden collision" out of core: evaluate f and g once each,
+   spilling their images, then join the buckets. */
+void spill_claw_search(int maxres)
+{
+    struct challenge *c = &challenges[0];
+    u64 N = 1ull << n;
+
+    select_challenge(c);
+    setup_buffers();
+    setup_spill();
+    if (dynamic_mode)
+        setup_work();
+
+    double start_program = wtime();
+    sweep(FILL, 0, 1, N, NULL, 0, NULL, NULL);
+    fill_time = wtime() - start_program;
+
+    double start_probe = wtime();
+    sweep(PROBE, 0, 1, N, &c->nres, maxres, c->k1, c->k2);
+    spill_join(&c->nres, maxres, c->k1, c->k2);
+    probe_time = wtime() - start_probe;
+
+    compute_time = (wtime() - start_program) - communication_time;
+}
+
+/* Search the "golden collision" with distinguished points, changing the
+   version of the random function until a solution is found, or until
+   dp_max_versions versions were tried. */
+void dp_claw_search(int maxres)
+{
+    struct challenge *c = &challenges[0];
+
+    select_challenge(c);
+    setup_buffers();
+    u64 points = DP_POINTS_PER_SLOT * dict_size * num_processes;
+    if (dp_max_versions == 0)
+        dp_max_versions = MAX(DP_MIN_VERSIONS,
+                              ceil(DP_MAX_VERSIONS_FACTOR * ldexp(1, n) / points));
+
+    double start_program = wtime();
+    for (u64 v = 0; v < dp_max_versions; v++) {
+        dp_set_version(v);
+        int early_exit = sweep(WALK, 0, 0, points, &c->nres,
+                               maxres, c->k1, c->k2);
+        if (early_exit || solution_found(c->nres))
+            break;
+    }
+    probe_time = wtime() - start_program;
+    compute_time = probe_time - communication_time;
 }
 
 /************************** command-line options ****************************/
@@ -569,23 +4792,73 @@ void usage(char **argv)
         printf("--C0 N                      1st ciphertext (in hex)\n");
         printf("--C1 N                      2nd ciphertext (in hex)\n");
         printf("--mem N                     memory available (in GB)\n");
+        printf("--kernel NAME               avx512, avx2 or scalar [default: best]\n");
+        printf("--threads N                 worker threads per process [default 1]\n");
+        printf("--dict NAME                 linear or bucket hash table [default linear]\n");
+        printf("--join NAME                 hash or sort(-merge) join [default hash]\n");
+        printf("--dp                        distinguished points search (low memory)\n");
+        printf("--dp-versions V             give up after V versions [default: 50\n");
+        printf("                            times 2^n / points per version]\n");
+        printf("--save-dict DIR             write the dictionary shards to DIR\n");
+        printf("--load-dict DIR             map the dictionary shards of DIR, no fill\n");
+        printf("--challenges FILE           \"C0 C1\" pairs to solve, one per line\n");
+        printf("--checkpoint DIR            write checkpoints to DIR\n");
+        printf("--checkpoint-interval S     seconds between checkpoints [default 600]\n");
+        printf("--checkpoint-dict           also save the dictionary shards\n");
+        printf("--resume                    restart from the checkpoints of DIR\n");
+        printf("--spill DIR                 out of core: evaluate f and g once,\n");
+        printf("                            spilling 2^c buckets to DIR\n");
+        printf("--exchange NAME             flat or hier(archical) all-to-all, or rma\n");
+        printf("                            (one-sided puts) [default flat]\n");
+        printf("--ranks-per-node K          split the nodes in groups of K processes\n");
+        printf("--dynamic                   hand out the keys in chunks (load balancing)\n");
+        printf("--weight W                  relative size of the shard of the process,\n");
+        printf("                            or \"mem\" for its share of the node memory\n");
+        printf("--plan P                    print the memory, rounds and time predicted\n");
+        printf("                            for P processes, without searching\n");
+        printf("--report FILE               append the keys per second of each phase to\n");
+        printf("                            FILE (CSV if it ends with .csv, else JSON)\n");
+        printf("--trace DIR                 write a timeline of each process to DIR\n");
+        printf("                            (Chrome trace format)\n");
         printf("\n");
-        printf("All arguments are required\n");
+        printf("Arguments --n, and --C0 and --C1 or --challenges are required\n");
+        printf("(only --n with --save-dict or --plan)\n");
         exit(0);
 }
 
 void process_command_line_options(int argc, char ** argv)
 {
-        struct option longopts[5] = {
+        struct option longopts[26] = {
                 {"n", required_argument, NULL, 'n'},
                 {"C0", required_argument, NULL, '0'},
                 {"C1", required_argument, NULL, '1'},
                 {"mem", required_argument, NULL, 'm'},
+                {"kernel", required_argument, NULL, 'k'},
+                {"threads", required_argument, NULL, 't'},
+                {"dict", required_argument, NULL, 'd'},
+                {"join", required_argument, NULL, 'j'},
+                {"dp", no_argument, NULL, 'p'},
+                {"dp-versions", required_argument, NULL, 'V'},
+                {"save-dict", required_argument, NULL, 's'},
+                {"load-dict", required_argument, NULL, 'l'},
+                {"challenges", required_argument, NULL, 'c'},
+                {"checkpoint", required_argument, NULL, 'C'},
+                {"checkpoint-interval", required_argument, NULL, 'I'},
+                {"checkpoint-dict", no_argument, NULL, 'D'},
+                {"resume", no_argument, NULL, 'r'},
+                {"spill", required_argument, NULL, 'S'},
+                {"exchange", required_argument, NULL, 'x'},
+                {"ranks-per-node", required_argument, NULL, 'R'},
+                {"weight", required_argument, NULL, 'w'},
+                {"dynamic", no_argument, NULL, 'y'},
+                {"plan", required_argument, NULL, 'P'},
+                {"report", required_argument, NULL, 'o'},
+                {"trace", required_argument, NULL, 'T'},
                 {NULL, 0, NULL, 0}
         };
         char ch;
         int set = 0;
-        double memory_max;
+        u64 c0 = 0, c1 = 0;
         while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
                 switch (ch) {
                 case 'n':
@@ -594,71 +4867,248 @@ void process_command_line_options(int argc, char ** argv)
                         break;
                 case '0':
                         set |= 1;
-                        u64 c0 = strtoull(optarg, NULL, 16);
-                        C[0][0] = c0 & 0xffffffff;
-                        C[0][1] = c0 >> 32;
+                        c0 = strtoull(optarg, NULL, 16);
                         break;
                 case '1':
                         set |= 2;
-                        u64 c1 = strtoull(optarg, NULL, 16);
-                        C[1][0] = c1 & 0xffffffff;
-                        C[1][1] = c1 >> 32;
+                        c1 = strtoull(optarg, NULL, 16);
+                        break;
+                case 'c':
+                        read_challenges(optarg);
+                        break;
+                case 's':
+                        dict_save_dir = optarg;
+                        break;
+                case 'l':
+                        dict_load_dir = optarg;
+                        break;
+                case 'C':
+                        checkpoint_dir = optarg;
+                        break;
+                case 'I':
+                        checkpoint_interval = atof(optarg);
+                        break;
+                case 'D':
+                        checkpoint_dict = true;
+                        break;
+                case 'r':
+                        resume = true;
+                        break;
+                case 'S':
+                        spill_dir = optarg;
                         break;
                 case 'm':
                         memory_max = atof(optarg);
-                        set_compression_factor(memory_max);
+                        break;
+                case 'k':
+                        select_kernel(optarg);
+                        break;
+                case 'd':
+                        select_dict_engine(optarg);
+                        break;
+                case 'j':
+                        if (strcmp(optarg, "hash") == 0)
+                                join = HASH_JOIN;
+                        else if (strcmp(optarg, "sort") == 0)
+                                join = SORT_JOIN;
+                        else
+                                errx(1, "unknown join \"%s\" (hash or sort)", optarg);
+                        break;
+                case 'x':
+                        if (strcmp(optarg, "flat") == 0)
+                                exchange_mode = FLAT_EXCHANGE;
+                        else if (strcmp(optarg, "hier") == 0)
+                                exchange_mode = HIER_EXCHANGE;
+                        else if (strcmp(optarg, "rma") == 0)
+                                exchange_mode = RMA_EXCHANGE;
+                        else
+                                errx(1, "unknown exchange \"%s\" (flat, hier or rma)", optarg);
+                        break;
+                case 'R':
+                        ranks_per_node = atoi(optarg);
+                        if (ranks_per_node < 1)
+                                errx(1, "--ranks-per-node must be positive");
+                        break;
+                case 'y':
+                        dynamic_mode = true;
+                        break;
+                case 'P':
+                        plan_processes = atoi(optarg);
+                        if (plan_processes < 1)
+                                errx(1, "--plan needs a positive number of processes");
+                        break;
+                case 'o':
+                        report_file = optarg;
+                        break;
+                case 'T':
+                        trace_dir = optarg;
+                        break;
+                case 'w':
+                        if (strcmp(optarg, "mem") == 0)
+                                weight_from_memory = true;
+                        else if ((shard_weight = atof(optarg)) <= 0)
+                                errx(1, "--weight must be positive or \"mem\"");
+                        break;
+                case 'p':
+                        dp_mode = true;
+                        break;
+                case 'V':
+                        dp_max_versions = strtoull(optarg, NULL, 10);
+                        if (dp_max_versions == 0)
+                                errx(1, "--dp-versions needs a positive number of versions");
+                        break;
+                case 't':
+                        num_threads = atoi(optarg);
+#ifndef _OPENMP
+                        if (num_threads != 1)
+                                errx(1, "compiled without OpenMP, use --threads 1");
+#endif
+                        if (num_threads < 1)
+                                errx(1, "--threads must be positive");
                         break;
                 default:
                         errx(1, "Unknown option\n");
                 }
         }
-        if (n == 0 || set != 3) {
+        if (set == 3)
+                add_challenge(c0, c1);
+        if (n == 0 || (set != 3 && set != 0)
+            || (num_challenges == 0 && dict_save_dir == NULL
+                && plan_processes == 0)) {
         	usage(argv);
         	exit(1);
         }
+        if ((dict_save_dir != NULL || dict_load_dir != NULL)
+            && (join != HASH_JOIN || dp_mode))
+                errx(1, "--save-dict and --load-dict need the hash dictionary");
+        if (plan_processes > 0 && (dp_mode || spill_dir != NULL
+            || dict_load_dir != NULL))
+                errx(1, "--plan predicts the rounds of a search, without --dp, "
+                        "--spill or --load-dict");
+        if (dp_mode && (weight_from_memory || shard_weight != 1))
+                errx(1, "the distinguished points search has no --weight");
+        if (dp_mode && num_challenges != 1)
+                errx(1, "--dp solves a single challenge");
+        if (dp_max_versions > 0 && !dp_mode)
+                errx(1, "--dp-versions needs --dp");
+        if ((resume || checkpoint_dict) && checkpoint_dir == NULL)
+                errx(1, "--resume and --checkpoint-dict need --checkpoint DIR");
+        if (checkpoint_dir != NULL && dynamic_mode)
+                errx(1, "the checkpoints need the cyclic distribution of keys");
+        if (checkpoint_dir != NULL && dp_mode)
+                errx(1, "the distinguished points search has no checkpoints");
+        if (checkpoint_dict && join != HASH_JOIN)
+                errx(1, "--checkpoint-dict needs the hash dictionary");
+        if (spill_dir != NULL && (dp_mode || join != HASH_JOIN
+            || num_challenges != 1 || dict_save_dir != NULL
+            || dict_load_dir != NULL || checkpoint_dir != NULL))
+                errx(1, "--spill solves a single challenge with the hash "
+                        "dictionary, without saved dictionaries or checkpoints");
+        if (exchange_mode == RMA_EXCHANGE && (dp_mode || join != HASH_JOIN
+            || spill_dir != NULL || checkpoint_dir != NULL))
+                errx(1, "--exchange rma needs the hash dictionary, without "
+                        "--dp, --spill or checkpoints");
+        if (PACKED_ELEMENTS && 2 * n <= 64)
+                element_words = 1;
+        /* the memory needed depends on the join */
+        if (dict_load_dir != NULL)
+                load_dict_compress_factor();
+        else if (memory_max > 0 && !dp_mode)
+                set_compression_factor(memory_max);
 }
 
 /******************************************************************************/
 
 int main(int argc, char **argv)
 {
-    /* MPI initialization */
-    MPI_Init(&argc, &argv);
+    /* MPI initialization; only the master thread of a process calls MPI */
+    int thread_support;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
     MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    assert(
-        num_processes != 0
-        && (num_processes & (num_processes - 1)) == 0
-        && "The number of processes must be a power of two."
-    );
 
     process_command_line_options(argc, argv);
+    setup_check_bits();
+    if (num_threads > 1 && thread_support < MPI_THREAD_FUNNELED)
+        errx(1, "the MPI library does not support threads");
+    setup_topology();
+    if (kernel == NULL)
+        select_kernel(NULL);
 
-    /* setup the distributed dictionary strategy */
-    dict_size = ceil(1.125 * (1ull << (n - compress_factor)) / num_processes);
-    dict_size_global = dict_size * num_processes;
-	dict_setup(dict_size);
+    setup_telemetry();
+
+    /* dry run */
+    if (plan_processes > 0) {
+        print_plan();
+        MPI_Finalize();
+        return 0;
+    }
+
+    /* setup the distributed dictionary strategy (whole buckets per process) */
+    if (dp_mode) {
+        dp_setup(dp_table_size(memory_max));
+    } else {
+        setup_shards(ceil(SLOTS_PER_ENTRY * (1ull << (n - compress_factor))));
+        if (join == HASH_JOIN)
+            dict_setup(dict_size);
+        else
+            join_setup(dict_size);
+    }
+    calibrate(MIN(CALIBRATION_KEYS, dict_size / 2));
+    reset_telemetry();
 
     /* print some useful information */
     print_execution_info();
+    print_calibration();
 
     /* search */
-    u64 k1[16], k2[16];
-    int nkey = golden_claw_search(16, k1, k2);
+    if (dp_mode)
+        dp_claw_search(MAX_SOLUTIONS);
+    else if (spill_dir != NULL)
+        spill_claw_search(MAX_SOLUTIONS);
+    else
+        golden_claw_search(MAX_SOLUTIONS);
 
 	/* validation; barriers to print all solutions together */
-    MPI_Barrier(MPI_COMM_WORLD);
-    for (int i = 0; i < nkey; i++) {
-        assert(f(k1[i]) == g(k2[i]));
-        assert(is_good_pair(k1[i], k2[i]));
-        printf("Solution found: (%" PRIx64 ", %" PRIx64 ") [checked OK]\n", k1[i], k2[i]);
+    for (int c = 0; c < num_challenges; c++) {
+        struct challenge *challenge = &challenges[c];
+        select_challenge(challenge);
+        MPI_Barrier(MPI_COMM_WORLD);
+        if (num_challenges > 1 && rank == ROOT_RANK)
+            printf("Challenge C0=%08x%08x C1=%08x%08x:\n", C[0][1], C[0][0],
+                   C[1][1], C[1][0]);
+        MPI_Barrier(MPI_COMM_WORLD);
+        for (int i = 0; i < challenge->nres; i++) {
+            u64 k1 = challenge->k1[i], k2 = challenge->k2[i];
+            assert(f(k1) == g(k2));
+            assert(is_good_pair(k1, k2));
+            printf("Solution found: (%" PRIx64 ", %" PRIx64 ") [checked OK]\n", k1, k2);
+        }
+        int nres;
+        MPI_Allreduce(&challenge->nres, &nres, 1, MPI_INT, MPI_SUM,
+                      MPI_COMM_WORLD);
+        if (nres == 0 && rank == ROOT_RANK)
+            printf("No solution found\n");
+        MPI_Barrier(MPI_COMM_WORLD);
     }
-    MPI_Barrier(MPI_COMM_WORLD);
 
     /* print some post-processing statistics */
     print_average_buffer_occupancy();
+    print_buffer_tuning();
+    print_exchanged_data();
     print_execution_times();
+    if (dp_mode)
+        print_dp_statistics();
+    if (spill_dir != NULL)
+        print_spill_statistics();
+    if (exchange_mode == RMA_EXCHANGE)
+        print_rma_statistics();
+    print_work_statistics();
+    print_telemetry();
     print_statistics_as_structured_data();
+    write_report();
+    write_trace();
 
     MPI_Finalize();
+    return 0;
 }
@@ -24,7 +24,7 @@ export OMPI_MCA_btl='^openib'
 mpiexec --map-by ppr:1:node --hostfile $OAR_NODEFILE hostname
 
 # Compile the program
-mpicc -g mitm_parallel.c -O3 -Wall -Wextra -lm -D EARLY_EXIT=0 -o mitm_parallel
+mpicc -g mitm_parallel.c -O3 -Wall -Wextra -fopenmp -lm -D EARLY_EXIT=0 -o mitm_parallel
 chmod u+x mitm_parallel
 
 # Evaluate performance for different number of cores
@@ -67,3 +67,17 @@ do
         --n 33 --C0 77e8d746a6515fb6 --C1 e8e9cb4712662819 --mem $mem
 done
 echo "/// end ///"
+
+# Compare the flat and the two-level (hierarchical) exchanges: the latter sends
+# nodes^2 inter-node messages instead of P^2
+echo "/// results ///"
+for num_cores in 52 104 208 256
+do
+    for exchange in flat hier
+    do
+        mpiexec -n $num_cores --hostfile $OAR_NODEFILE ./mitm_parallel \
+            --n 30 --C0 a0bca8205bffb86d --C1 9cc9039976126254 \
+            --exchange $exchange
+    done
+done
+echo "/// end ///"